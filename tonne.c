@@ -15,6 +15,14 @@
 #include <sys/types.h>
 #include <time.h>
 #include <stdarg.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <regex.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
 
 
 /*** Defines ***/
@@ -23,7 +31,52 @@
 
 #define TONNE_VERSION "0.0.1"
 
+// Default tab stop. It can be changed with the TONNE_TAB_STOP environment variable or with Ctrl+T
 #define TONNE_TAB_STOP 8
+// Biggest tab stop we accept
+#define MAX_TAB_STOP 32
+
+// Flags that tell updateRow which render kernel a row needs
+// ROW_HAS_ESCAPES is for control characters (C0, DEL and C1) and bytes that are not valid UTF-8
+#define ROW_HAS_TABS 1
+#define ROW_HAS_ESCAPES 2
+
+// Number of bytes shown on every line of the hex view
+#define HEX_BYTES_PER_LINE 16
+// Hex digits of the offset at the start of every line of the hex view. Files bigger than 4GB get more digits, up to 16
+#define HEX_MIN_OFFSET_DIGITS 8
+#define HEX_MAX_OFFSET_DIGITS 16
+// Size classes of the row allocator go from POOL_MIN_BLOCK to POOL_MAX_BLOCK bytes, bigger blocks come from malloc
+#define POOL_MIN_BLOCK 16
+#define POOL_MAX_BLOCK (64 * 1024)
+#define POOL_MAX_CLASSES 32
+// The pool gets memory from malloc in slabs of this size. It must be a power of 2 since slabs are aligned to it
+#define POOL_SLAB_SIZE (256 * 1024)
+
+// The file watcher hashes the file in chunks of this size to find the parts that changed on disk
+#define WATCH_CHUNK_SIZE (256 * 1024)
+// Seconds between checks of the file on disk
+#define WATCH_INTERVAL 1
+// Files bigger than this are hashed by several threads, up to WATCH_MAX_THREADS
+#define WATCH_PARALLEL_MIN (8 * 1024 * 1024)
+#define WATCH_MAX_THREADS 8
+
+// The checksum of the file is joined from the CRCs of chunks of about this many rows, so an edit only hashes its chunk again
+#define STATS_CHUNK_ROWS 4096
+// Polynomial of CRC-32 (the one of zlib, gzip and PNG) with its bits reversed
+#define CRC32_POLY 0xedb88320
+
+// Number of bytes we look at to decide if a file is binary
+#define BINARY_PROBE_SIZE 8192
+
+// Memory (in MB) the rows of all open buffers can use before we start dropping the ones not in use
+// It can be changed with the TONNE_MEMORY_BUDGET environment variable
+#define TONNE_MEMORY_BUDGET 64
+
+// Size of the windows batch mode reads the input in, and of each of its two output buffers
+#define BATCH_WINDOW (8 * 1024 * 1024)
+// Number of groups of a pattern that can be used in a replacement (\1 to \9) plus the whole match
+#define BATCH_MAX_GROUPS 10
 
 enum editorKeys{
     ARROW_LEFT = 1000,
@@ -34,7 +87,11 @@ enum editorKeys{
     PAGE_DOWN,
     HOME_KEY,
     END_KEY,
-    DEL_KEY
+    DEL_KEY,
+    // Not a real key. readKey returns it when the terminal was resized so the screen gets redrawn
+    RESIZE_EVENT,
+    // Not a real key either. readKey returns it when the open file was changed on disk
+    FILE_CHANGED_EVENT
 };
 
 
@@ -48,44 +105,230 @@ typedef struct erow {
     // Variables to define how special characters will be rendered
     int rsize;
     char *render;
+    // Bytes allocated for render. It only grows, so rendering the row again doesnt allocate
+    // If it is 0 and render isnt NULL, render points to chars (rows without tabs or control characters)
+    int rcap;
+    // What the row has (ROW_HAS_TABS, ROW_HAS_ESCAPES). Flags are only added while editing, so they can be set when the row no longer has them
+    int flags;
+
+    // Number of screen lines the row takes when soft wrap is on
+    int wraplines;
+
+    // Number of words and of UTF-8 characters in the row, for the statistics on the status bar
+    int words;
+    int nchars;
+
+    // Line break after the row in the file: the carriage returns we stripped and if there is a newline
+    // Only the last row of a file can have no newline
+    int eolcr;
+    int eolnl;
 } erow;
 
-// Global state struct
-struct editorConfig{
-    // Size of the terminal
-    int screenrows;
-    int screencols;
-
-    // Offset between the file rows and the terminal rows
-    int rowoffset;
+// Header stored right before the characters of every row
+// Copying rows to the clipboard shares the characters instead of copying them, refs counts the rows holding them
+// cap is the space allocated for the characters. It grows geometrically so typing only allocates once in a while
+typedef struct rowchars {
+    int refs;
+    int cap;
+} rowchars;
+
+// We get the header of the characters of a row
+#define ROW_CHARS_HEADER(chars) ((rowchars *)(chars) - 1)
+
+// A run of rows for the checksum. Chunks know how many rows they have, not where they start
+// That way inserting or removing rows only changes the chunk they are in and not the ones after it
+typedef struct sumchunk {
+    int rows;
+    // If the rows changed since we made the CRC
+    int stale;
+    uint32_t crc;
+    // Bytes the rows take in the file, we need them to join the CRCs
+    size_t bytes;
+} sumchunk;
+
+// A chunk of WATCH_CHUNK_SIZE bytes of the file as it was when we read it
+typedef struct filechunk {
+    uint64_t hash;
+    // Row that contains the first byte of the chunk, and the offset where that row starts
+    int row;
+    size_t rowstart;
+} filechunk;
+
+// Free blocks of the row allocator are linked in a list per size class through the blocks themselves
+typedef struct poolblock {
+    struct poolblock *next;
+} poolblock;
+
+// Header at the start of every slab of the row allocator. We find it by aligning the address of a block
+typedef struct poolslab {
+    // Free blocks counted while trimming the pool. -1 means the slab is going to be freed
+    int freeblocks;
+    // Next slab to be freed while trimming
+    struct poolslab *next;
+} poolslab;
+
+// Allocator for the characters and renders of the rows
+// Blocks are recycled in lists by size instead of going back to malloc, so editing doesnt call malloc or free
+typedef struct rowpool {
+    size_t sizes[POOL_MAX_CLASSES];
+    int numclasses;
+    poolblock *freelist[POOL_MAX_CLASSES];
+} rowpool;
+
+// Datatype for the hex view of a binary file
+// The file is mapped in memory and only the bytes on screen are formatted, so memory use doesnt depend on the size of the file
+typedef struct hexview {
+    // The mapping of the file. If it is NULL we are not in hex mode
+    unsigned char *map;
+    size_t size;
+    int fd;
+    // If we could only open the file for reading
+    int readonly;
+    // Hex digits needed to write the offset of the last byte of the file
+    int offsetdigits;
+
+    // Byte shown at the top left of the screen
+    size_t offset;
+    // Byte under the cursor
+    size_t cursor;
+    // If we already overwrote the high half of the byte under the cursor
+    int nibble;
+
+    // Sorted list of the pages that were changed since the last save
+    // The mapping is private so only these pages take memory, we write them back to the file on save
+    size_t *dirty;
+    int numdirty;
+    int dirtycap;
+} hexview;
+
+// State of an open file. The active file is in E.file, the others are kept in their buffer slot
+// Switching buffers copies the whole struct, so every field added here is saved and loaded with the file
+typedef struct efile {
+    // Name of the open file
+    char *filename;
 
-    // Offset for row characters that are shown
-    int coloffset;
+    // Number of rows
+    int numrows;
+    // A pointer to the first row of text to be displayed
+    erow *row;
+    // Number of changes since the file was opened
+    int dirty;
+    // Bytes used by the characters and the renders of the rows
+    size_t charbytes;
+    size_t renderbytes;
 
     // Cursor position
     int cx, cy;
     // index for the position of the cursor inside the renderization of a row
     int rx;
+    // Row where the selection for cut and copy starts. -1 if there is no mark
+    int markrow;
 
-    // Number of rows
-    int numrows;
+    // Offset between the file rows and the terminal rows
+    int rowoffset;
+    // Offset for row characters that are shown
+    int coloffset;
+    // Visual line (counting wrapped lines) shown at the top of the screen when soft wrap is on
+    int vrowoffset;
+    // Fenwick tree with the number of wrapped lines of every row (1 indexed)
+    int *wraptree;
+    // Number of entries allocated for the tree
+    int wrapcap;
+    // Number of columns the tree was built for. If it doesnt match screencols the tree has to be rebuilt
+    int wrapcols;
+    // Tab stop the rows of this file were rendered with. If it isnt E.tabstop the rows with tabs are rendered again
+    int rowtabstop;
+
+    // State of the hex view, used instead of the rows for binary files
+    hexview hex;
+
+    // Hashes of the chunks of the file when we read it, to find what changed when it is rewritten
+    // There is one more entry than chunks for the end of the file
+    filechunk *chunks;
+    int numchunks;
+    // What stat said about the file when we read it
+    struct stat filestat;
+    // Last time we checked the file on disk
+    time_t watchtime;
+
+    // Totals of the rows for the status bar. They are updated on every edit so drawing them costs nothing
+    long long words;
+    long long nchars;
+    // Size the file would have with the rows as they are, counting the line breaks the rows had in the file
+    size_t filebytes;
+    // The rows split in chunks of about STATS_CHUNK_ROWS rows, with their CRCs
+    sumchunk *sums;
+    int numsums;
+    int sumcap;
+    // CRC-32 of the bytes of the file, the same `crc32` or zlib give. It is only made again when a chunk changed
+    int checksumstale;
+    uint32_t checksum;
+} efile;
+
+// An open file that is not being shown
+// When we switch buffers the state of the file is moved from E to here, and back when we switch to it again
+typedef struct ebuffer {
+    efile file;
+
+    // Value of the buffer clock the last time the buffer was active. The lowest is the least recently used
+    unsigned long lastused;
+    // If the rows were dropped to save memory and the file has to be read again
+    int evicted;
+} ebuffer;
 
-    // A pointer to the first row of text to be displayed
-    erow *row;
-    // Name of the open file
-    char *filename;
+// Global state struct
+struct editorConfig{
+    // Size of the terminal
+    int screenrows;
+    int screencols;
+
+    // Number of columns between tab stops
+    int tabstop;
+
+    // If soft wrap is on, long rows continue on the next screen line instead of scrolling sideways
+    int softwrap;
+    // Set by the SIGWINCH handler when the terminal changes size
+    volatile sig_atomic_t resized;
+
+    // The active file
+    efile file;
 
     struct termios original_termios;
 
     // status bar message string
-    char statusmsg[80];
+    char statusmsg[160];
     // status bar message timeout
     time_t statusmsg_time;
+
+    // All the open files. The one at curbuffer is the one loaded on E, its slot is updated when we switch away from it
+    ebuffer *buffers;
+    int numbuffers;
+    int curbuffer;
+    // Counter that goes up every time we switch buffers, used to find the least recently used one
+    unsigned long bufferclock;
+    // Bytes the rows of all buffers can use before inactive buffers are dropped
+    size_t membudget;
+
+    // Rows that were cut or copied. They share their characters with the rows of the file
+    erow *clip;
+    int cliplen;
+    int clipcap;
+
+    // Memory of the rows of all buffers comes from here
+    rowpool pool;
 };
 
 struct editorConfig E;
 
 
+/*** Prototypes ***/
+
+// Functions that are used before the place they are defined
+void setStatusMessage(const char *fmt, ...);
+void refreshScreen();
+int watchPoll();
+
+
 /*** Terminal configuration ***/
 
 // Exit function. Prints the error message and exits with code 1
@@ -164,7 +407,12 @@ int readKey(){
     // TODO -> think if this can just be an if. That way we dont get locked
     while ((nread = read(STDIN_FILENO, &c, 1)) != 1){
         // If read fails and it is not because of the timeout (timeout fails set errno var to EAGAIN) we kill the program
-        if (nread == -1 && errno != EAGAIN) die("read");
+        // The resize signal can also interrupt the read (EINTR), that is not an error either
+        if (nread == -1 && errno != EAGAIN && errno != EINTR) die("read");
+        // If the terminal was resized while we waited we return so the screen can be redrawn
+        if (E.resized) return RESIZE_EVENT;
+        // While we wait for keys we check once in a while if the file changed on disk
+        if (watchPoll()) return FILE_CHANGED_EVENT;
     }
 
     // check for escape sequences
@@ -276,168 +524,1581 @@ int getWindowSize(int *rows, int *cols){
     }
 }
 
+// We get the size of the terminal and keep 2 rows for the status bar and the message bar
+void updateWindowSize(){
+    E.resized = 0;
+    int oldcols = E.screencols;
+    if (getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
+    // The wrap layout was made for the old width. Edits made at this width dont update it, so it cant be used even if we go back to that width
+    if (E.screencols != oldcols) E.file.wrapcols = 0;
+    // We remove 2 rows from the total available in the terminal so we have space for the status bar
+    E.screenrows --;
+    E.screenrows --;
+}
+
+// Signal handler for SIGWINCH. We only set a flag here, the real work is done outside of the handler
+void handleSigWinch(int sig){
+    (void)sig;
+    E.resized = 1;
+}
+
+
+/*** soft wrap ***/
+
+// Number of screen lines a row takes when it is wrapped
+// An empty row still takes one line, and a row that fills the last line exactly gets an extra one so the cursor has a place to be after the last character
+int wrapRowLines(erow *row){
+    return row->rsize / E.screencols + 1;
+}
+
+// We add delta to the number of wrapped lines of the row at index 'at'
+// Every node of the tree holds the sum of a range of rows, we update all the nodes that cover this row
+void wrapTreeAdd(int at, int delta){
+    int i;
+    for (i = at + 1; i <= E.file.numrows; i += i & -i) E.file.wraptree[i] += delta;
+}
+
+// We get the number of wrapped lines taken by the first n rows
+int wrapTreePrefix(int n){
+    int sum = 0;
+    for (; n > 0; n -= n & -n) sum += E.file.wraptree[n];
+    return sum;
+}
+
+// We find the row that is shown on the visual line 'vline'
+// If subline isnt NULL we set it to the line inside that row. If vline is past the end of the file we return E.file.numrows
+int wrapTreeFind(int vline, int *subline){
+    int pos = 0;
+    int mask = 1;
+    // We get the biggest power of 2 that fits in the tree
+    while (mask * 2 <= E.file.numrows) mask *= 2;
+
+    // We go down the tree skipping every node that ends before vline
+    for (; mask > 0 && E.file.numrows > 0; mask /= 2){
+        if (pos + mask <= E.file.numrows && E.file.wraptree[pos + mask] <= vline){
+            pos += mask;
+            vline -= E.file.wraptree[pos];
+        }
+    }
+    if (subline) *subline = pos < E.file.numrows ? vline : 0;
+    return pos;
+}
+
+// We make sure the tree has space for 'n' rows
+void wrapTreeReserve(int n){
+    if (E.file.wrapcap >= n + 1) return;
+    E.file.wrapcap = E.file.wrapcap ? E.file.wrapcap : 16;
+    while (E.file.wrapcap < n + 1) E.file.wrapcap *= 2;
+    E.file.wraptree = realloc(E.file.wraptree, sizeof(int) * E.file.wrapcap);
+}
+
+// We lay out every row again. This is only needed the first time and when the width of the terminal changes
+void wrapTreeBuild(){
+    int i;
+    wrapTreeReserve(E.file.numrows);
+    E.file.wraptree[0] = 0;
+    for (i = 1; i <= E.file.numrows; i++){
+        E.file.row[i-1].wraplines = wrapRowLines(&E.file.row[i-1]);
+        E.file.wraptree[i] = E.file.row[i-1].wraplines;
+    }
+    // Every node adds its sum to the node right above it, that builds the whole tree in one pass
+    for (i = 1; i <= E.file.numrows; i++){
+        int parent = i + (i & -i);
+        if (parent <= E.file.numrows) E.file.wraptree[parent] += E.file.wraptree[i];
+    }
+    E.file.wrapcols = E.screencols;
+}
+
+// We add the last row of the file to the tree. It is called after E.file.numrows was incremented
+void wrapTreeAppend(){
+    int n = E.file.numrows;
+    wrapTreeReserve(n);
+    // The new node covers the rows from n - lowbit(n) to n, we get the rows before it from the rest of the tree
+    E.file.wraptree[n] = E.file.row[n-1].wraplines + wrapTreePrefix(n-1) - wrapTreePrefix(n - (n & -n));
+}
+
+// Rows were inserted or removed at 'at' and the n rows starting there are new, the rows after them only moved
+// We only rebuild the nodes after 'at' from the wraplines the rows already have, the rows before 'at' keep their nodes
+void wrapTreeSplice(int at, int n){
+    // If the layout is not up to date it is built for every row when it is needed
+    if (E.file.wrapcols != E.screencols) return;
+    int i;
+    wrapTreeReserve(E.file.numrows);
+    for (i = at; i < at + n; i++) E.file.row[i].wraplines = wrapRowLines(&E.file.row[i]);
+    for (i = at + 1; i <= E.file.numrows; i++) E.file.wraptree[i] = E.file.row[i-1].wraplines;
+    // The nodes before 'at' that have a parent after it are the ones that make up the prefix of 'at', we add them to their parents
+    for (i = at; i > 0; i -= i & -i){
+        int parent = i + (i & -i);
+        if (parent <= E.file.numrows) E.file.wraptree[parent] += E.file.wraptree[i];
+    }
+    // Then we build the rest like wrapTreeBuild does
+    for (i = at + 1; i <= E.file.numrows; i++){
+        int parent = i + (i & -i);
+        if (parent <= E.file.numrows) E.file.wraptree[parent] += E.file.wraptree[i];
+    }
+}
+
+// We rebuild the tree if it was never built or it was built for another terminal width
+void wrapEnsureLayout(){
+    if (E.file.wrapcols != E.screencols) wrapTreeBuild();
+}
+
+
+/*** pool allocator ***/
+
+// We make the list of size classes. Every power of 2 has a class and another one halfway to the next
+// That way a block is never more than a third bigger than what was asked for
+void poolInit(){
+    size_t size;
+    E.pool.numclasses = 0;
+    for (size = POOL_MIN_BLOCK; size <= POOL_MAX_BLOCK; size *= 2){
+        E.pool.sizes[E.pool.numclasses] = size;
+        E.pool.freelist[E.pool.numclasses++] = NULL;
+        if (size * 3 / 2 <= POOL_MAX_BLOCK){
+            E.pool.sizes[E.pool.numclasses] = size * 3 / 2;
+            E.pool.freelist[E.pool.numclasses++] = NULL;
+        }
+    }
+}
+
+// We find the smallest class that fits 'size' bytes. It returns -1 if it is too big for the pool
+int poolClass(size_t size){
+    int c;
+    for (c = 0; c < E.pool.numclasses; c++){
+        if (E.pool.sizes[c] >= size) return c;
+    }
+    return -1;
+}
+
+// We get a new slab and split it in free blocks of the class
+void poolRefill(int c){
+    void *mem;
+    if (posix_memalign(&mem, POOL_SLAB_SIZE, POOL_SLAB_SIZE) != 0) die("posix_memalign");
+    poolslab *slab = mem;
+    slab->freeblocks = 0;
+
+    char *block = (char *)(slab + 1);
+    char *end = (char *)slab + POOL_SLAB_SIZE;
+    for (; block + E.pool.sizes[c] <= end; block += E.pool.sizes[c]){
+        ((poolblock *)block)->next = E.pool.freelist[c];
+        E.pool.freelist[c] = (poolblock *)block;
+    }
+}
+
+// We allocate at least 'size' bytes and set *got to the real size of the block
+// Big blocks are rounded up to a power of 2 so they also grow geometrically
+void *poolAlloc(size_t size, size_t *got){
+    int c = poolClass(size);
+    if (c == -1){
+        *got = POOL_MAX_BLOCK;
+        while (*got < size) *got *= 2;
+        void *p = malloc(*got);
+        if (p == NULL) die("malloc");
+        return p;
+    }
+    if (E.pool.freelist[c] == NULL) poolRefill(c);
+    poolblock *block = E.pool.freelist[c];
+    E.pool.freelist[c] = block->next;
+    *got = E.pool.sizes[c];
+    return block;
+}
+
+// We give a block back to the pool. 'size' is the size poolAlloc gave us
+void poolFree(void *p, size_t size){
+    if (p == NULL) return;
+    int c = poolClass(size);
+    if (c == -1){
+        free(p);
+        return;
+    }
+    ((poolblock *)p)->next = E.pool.freelist[c];
+    E.pool.freelist[c] = p;
+}
+
+// We get the slab a block belongs to
+poolslab *poolSlabOf(void *p){
+    return (poolslab *)((uintptr_t)p & ~(uintptr_t)(POOL_SLAB_SIZE - 1));
+}
+
+// We give the slabs that have no blocks in use back to the system
+// It goes through all the free blocks, so we only do it after freeing a lot of rows at once
+void poolTrim(){
+    int c;
+    for (c = 0; c < E.pool.numclasses; c++){
+        int perslab = (POOL_SLAB_SIZE - sizeof(poolslab)) / E.pool.sizes[c];
+        poolblock *b;
+        poolblock **link;
+        poolslab *unused = NULL;
+
+        // We count the free blocks of every slab
+        for (b = E.pool.freelist[c]; b; b = b->next) poolSlabOf(b)->freeblocks++;
+
+        // We take out of the list the blocks of the slabs that are completely free
+        // The first time we see one of those slabs we add it to the list of slabs to free
+        link = &E.pool.freelist[c];
+        while ((b = *link) != NULL){
+            poolslab *slab = poolSlabOf(b);
+            if (slab->freeblocks == perslab){
+                slab->freeblocks = -1;
+                slab->next = unused;
+                unused = slab;
+            }
+            if (slab->freeblocks == -1){
+                *link = b->next;
+            }else{
+                link = &b->next;
+            }
+        }
+        // The blocks left in the list are in slabs we keep, we reset their counters
+        for (b = E.pool.freelist[c]; b; b = b->next) poolSlabOf(b)->freeblocks = 0;
+
+        // Now that no list points to them we can free the slabs
+        while (unused){
+            poolslab *next = unused->next;
+            free(unused);
+            unused = next;
+        }
+    }
+}
+
+
+/*** statistics ***/
+
+// We hash a block of bytes (FNV-1a, reading 8 bytes at a time)
+uint64_t hashBytes(const char *s, size_t len, uint64_t hash){
+    const uint64_t prime = 1099511628211ULL;
+    uint64_t word;
+    while (len >= sizeof(word)){
+        memcpy(&word, s, sizeof(word));
+        hash = (hash ^ word) * prime;
+        s += sizeof(word);
+        len -= sizeof(word);
+    }
+    while (len--) hash = (hash ^ (unsigned char)*s++) * prime;
+    return hash;
+}
+
+#define HASH_SEED 14695981039346656037ULL
+
+// A word is a run of characters that are not spaces, like wc counts them
+int isWordChar(int c){
+    return !isspace((unsigned char)c);
+}
+
+// UTF-8 continuation bytes (10xxxxxx) are part of the character before them
+int isCharStart(int c){
+    return ((unsigned char)c & 0xc0) != 0x80;
+}
+
+// We count the words and characters of a row
+void rowCountStats(erow *row){
+    int j;
+    row->words = 0;
+    row->nchars = 0;
+    for (j = 0; j < row->size; j++){
+        if (isWordChar(row->chars[j]) && (j == 0 || !isWordChar(row->chars[j-1]))) row->words++;
+        if (isCharStart(row->chars[j])) row->nchars++;
+    }
+}
+
+// Bytes the row takes in the file, with its line break
+size_t rowFileBytes(erow *row){
+    return row->size + row->eolcr + row->eolnl;
+}
+
+// We add (sign = 1) or subtract (sign = -1) the counts of a row to the totals
+void statsAddRow(erow *row, int sign){
+    E.file.words += sign * row->words;
+    E.file.nchars += sign * row->nchars;
+    E.file.filebytes += sign * rowFileBytes(row);
+}
+
+// We update a CRC-32 with 'len' more bytes. Like zlib's crc32(), the CRC of nothing is 0 and CRCs can be continued
+// It uses 8 tables to read 8 bytes at a time (slicing-by-8)
+uint32_t crc32Update(uint32_t crc, const char *s, size_t len){
+    static uint32_t table[8][256];
+    static int ready = 0;
+    if (!ready){
+        int i, k;
+        for (i = 0; i < 256; i++){
+            uint32_t c = i;
+            for (k = 0; k < 8; k++) c = c & 1 ? (c >> 1) ^ CRC32_POLY : c >> 1;
+            table[0][i] = c;
+        }
+        // table[k][i] is the CRC of byte i followed by k zero bytes
+        for (i = 0; i < 256; i++){
+            for (k = 1; k < 8; k++) table[k][i] = table[0][table[k-1][i] & 0xff] ^ (table[k-1][i] >> 8);
+        }
+        ready = 1;
+    }
+
+    const unsigned char *p = (const unsigned char *)s;
+    crc = ~crc;
+    while (len >= 8){
+        uint32_t low = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+        crc = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff] ^ table[5][(low >> 16) & 0xff] ^ table[4][low >> 24] ^
+            table[3][p[4]] ^ table[2][p[5]] ^ table[1][p[6]] ^ table[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// We multiply 2 polynomials modulo the CRC-32 polynomial
+uint32_t crc32MultMod(uint32_t a, uint32_t b){
+    uint32_t m = 1U << 31;
+    uint32_t p = 0;
+    while (m){
+        if (a & m) p ^= b;
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ CRC32_POLY : b >> 1;
+    }
+    return p;
+}
+
+// We get the CRC of the bytes of A followed by the bytes of B from the CRCs of both and the length of B (like zlib's crc32_combine)
+// Adding lenb zero bytes to A multiplies its CRC by x^(8*lenb), we get that power by squaring
+uint32_t crc32Combine(uint32_t crca, uint32_t crcb, size_t lenb){
+    // x^1, it is squared on every step to get x^2, x^4, x^8...
+    uint32_t power = 1U << 30;
+    // x^0
+    uint32_t shift = 1U << 31;
+    size_t bits = lenb;
+    int k;
+    // We need x^(8*lenb), 8 is x^(2^3) so we skip the first 3 squares
+    for (k = 0; k < 3; k++) power = crc32MultMod(power, power);
+    while (bits){
+        if (bits & 1) shift = crc32MultMod(power, shift);
+        power = crc32MultMod(power, power);
+        bits >>= 1;
+    }
+    return crc32MultMod(shift, crca) ^ crcb;
+}
+
+// We make sure there is space for n checksum chunks
+void statsReserve(int n){
+    if (E.file.sumcap >= n) return;
+    E.file.sumcap = E.file.sumcap ? E.file.sumcap : 16;
+    while (E.file.sumcap < n) E.file.sumcap *= 2;
+    E.file.sums = realloc(E.file.sums, sizeof(sumchunk) * E.file.sumcap);
+}
+
+// We find the checksum chunk that has the row at 'at' and set *first to the first row of the chunk
+int statsFindChunk(int at, int *first){
+    int c;
+    int start = 0;
+    for (c = 0; c < E.file.numsums - 1 && start + E.file.sums[c].rows <= at; c++) start += E.file.sums[c].rows;
+    *first = start;
+    return c;
+}
+
+// The row at 'at' changed, we mark its chunk to be hashed again
+void statsRowChanged(int at){
+    int first;
+    if (E.file.numsums > 0) E.file.sums[statsFindChunk(at, &first)].stale = 1;
+    E.file.checksumstale = 1;
+}
+
+// We add n rows inserted at 'at' to the chunk they are in. It is called after E.file.numrows counts them
+// Rows added at the end of the file go to a new chunk when the last one is full, so reading a file makes chunks of STATS_CHUNK_ROWS rows
+void statsInsertRows(int at, int n){
+    if (n == 0) return;
+    int c, first;
+    if (E.file.numsums > 0 && at == E.file.numrows - n){
+        c = E.file.numsums - 1;
+    }else{
+        c = statsFindChunk(at, &first);
+    }
+    if (E.file.numsums == 0 || (at == E.file.numrows - n && E.file.sums[c].rows >= STATS_CHUNK_ROWS)){
+        statsReserve(E.file.numsums + 1);
+        c = E.file.numsums++;
+        E.file.sums[c].rows = 0;
+    }
+    E.file.sums[c].rows += n;
+    E.file.sums[c].stale = 1;
+    E.file.checksumstale = 1;
+}
+
+// We take n rows removed at 'at' out of the chunks they were in. The chunks left empty are removed
+void statsRemoveRows(int at, int n){
+    if (n == 0) return;
+    int first;
+    int c = statsFindChunk(at, &first);
+    // The chunks before the first one we change stay as they are
+    int keep = c;
+    for (; c < E.file.numsums; c++){
+        int end = first + E.file.sums[c].rows;
+        int from = at > first ? at : first;
+        int to = at + n < end ? at + n : end;
+        if (from < to){
+            E.file.sums[c].rows -= to - from;
+            E.file.sums[c].stale = 1;
+        }
+        first = end;
+        if (E.file.sums[c].rows > 0) E.file.sums[keep++] = E.file.sums[c];
+    }
+    E.file.numsums = keep;
+    E.file.checksumstale = 1;
+}
+
+// We split the chunks that grew too big with inserted rows so an edit never hashes too many rows again
+void statsSplitChunks(){
+    int c, extra = 0;
+    for (c = 0; c < E.file.numsums; c++){
+        if (E.file.sums[c].rows > 2 * STATS_CHUNK_ROWS) extra += (E.file.sums[c].rows - 1) / STATS_CHUNK_ROWS;
+    }
+    if (extra == 0) return;
+    statsReserve(E.file.numsums + extra);
+
+    // We move the chunks from the end so we dont write over the ones we didnt move yet
+    int to = E.file.numsums + extra;
+    for (c = E.file.numsums - 1; c >= 0; c--){
+        sumchunk chunk = E.file.sums[c];
+        if (chunk.rows <= 2 * STATS_CHUNK_ROWS){
+            E.file.sums[--to] = chunk;
+            continue;
+        }
+        int pieces = (chunk.rows + STATS_CHUNK_ROWS - 1) / STATS_CHUNK_ROWS;
+        int i;
+        for (i = pieces - 1; i >= 0; i--){
+            E.file.sums[--to].rows = i == pieces - 1 ? chunk.rows - i * STATS_CHUNK_ROWS : STATS_CHUNK_ROWS;
+            E.file.sums[to].stale = 1;
+        }
+    }
+    E.file.numsums += extra;
+}
+
+// We get the CRC-32 of the file. Only the chunks that changed since last time are hashed again
+uint32_t statsChecksum(){
+    if (!E.file.checksumstale) return E.file.checksum;
+    statsSplitChunks();
+
+    uint32_t crc = 0;
+    int c;
+    int r = 0;
+    for (c = 0; c < E.file.numsums; c++){
+        sumchunk *chunk = &E.file.sums[c];
+        if (chunk->stale){
+            chunk->crc = 0;
+            chunk->bytes = 0;
+            int i;
+            for (i = r; i < r + chunk->rows; i++){
+                erow *row = &E.file.row[i];
+                int j;
+                chunk->crc = crc32Update(chunk->crc, row->chars, row->size);
+                for (j = 0; j < row->eolcr; j++) chunk->crc = crc32Update(chunk->crc, "\r", 1);
+                if (row->eolnl) chunk->crc = crc32Update(chunk->crc, "\n", 1);
+                chunk->bytes += rowFileBytes(row);
+            }
+            chunk->stale = 0;
+        }
+        r += chunk->rows;
+        // The CRC of the file is joined from the CRCs of the chunks
+        crc = crc32Combine(crc, chunk->crc, chunk->bytes);
+    }
+    E.file.checksum = crc;
+    E.file.checksumstale = 0;
+    return E.file.checksum;
+}
+
+
 /*** row operations ***/
 
+// We allocate the characters of a row, with space for the header that counts who is holding them
+char *rowCharsAlloc(size_t len){
+    size_t got;
+    rowchars *header = poolAlloc(sizeof(rowchars) + len, &got);
+    header->refs = 1;
+    header->cap = got - sizeof(rowchars);
+    return (char *)(header + 1);
+}
+
+// We add a holder to the characters of a row
+void rowCharsRetain(char *chars){
+    ROW_CHARS_HEADER(chars)->refs++;
+}
+
+// We remove a holder from the characters of a row, the last one frees them
+void rowCharsRelease(char *chars){
+    if (chars == NULL) return;
+    rowchars *header = ROW_CHARS_HEADER(chars);
+    if (--header->refs == 0) poolFree(header, sizeof(rowchars) + header->cap);
+}
+
+// We make sure the row is the only one holding its characters before we change them (copy on write)
+void rowMakeWritable(erow *row){
+    if (ROW_CHARS_HEADER(row->chars)->refs == 1) return;
+    char *copy = rowCharsAlloc(row->size + 1);
+    memcpy(copy, row->chars, row->size + 1);
+    rowCharsRelease(row->chars);
+    row->chars = copy;
+}
+
 int rowCxToRx(erow *row, int cx){
 
+    // Without tabs every character takes one column
+    if (!(row->flags & ROW_HAS_TABS)) return cx;
+
     int rx = 0;
     int j;
     // we iterate the row up to the place the cursor is at
     for (j = 0; j < cx; j++){
         // If one of the characters before the cursor positon is a tab
         if (row->chars[j] == '\t')
-            // We move rx forwards until the next column that is a multiple of 8 (assuming TAB_STOP is 8)
-            // We do this by adding 8 and then subtracting however much we are past the previous multiple of 8
-            rx += (TONNE_TAB_STOP-1) - (rx % TONNE_TAB_STOP);
+            // We move rx forwards until the next column that is a multiple of the tab stop
+            // We do this by adding the tab stop and then subtracting however much we are past the previous multiple of it
+            rx += (E.tabstop-1) - (rx % E.tabstop);
         // We add one to rx (this is why we subtract one from tabstop on the if, because this always adds one afterwards)
         rx++;
     }
     return rx;
 }
 
-void updateRow(erow *row){
+// We free the render of a row. Renders that point to the characters of the row have nothing to free
+void rowFreeRender(erow *row){
+    if (row->rcap > 0) poolFree(row->render, row->rcap);
+    row->render = NULL;
+    row->rcap = 0;
+}
+
+// We free the memory of a row
+void freeRow(erow *row){
+    rowFreeRender(row);
+    rowCharsRelease(row->chars);
+}
+
+// We get the flags a byte adds to a row
+// Bytes from 0x80 could be part of a sequence that is not valid UTF-8, the escaping kernel checks the whole sequence
+int rowCharClass(int c){
+    if (c == '\t') return ROW_HAS_TABS;
+    if (c < 0x20 || c >= 0x7f) return ROW_HAS_ESCAPES;
+    return 0;
+}
 
-    // We create a counter for the number of tabs in the row
+// We get the length of the UTF-8 character that starts at s, or 0 if it is not valid or it is a C1 control character
+// Overlong forms, surrogates and code points after U+10FFFF are not valid
+int utf8Length(const char *s, int len){
+    const unsigned char *p = (const unsigned char *)s;
+    int n, j;
+    unsigned char min = 0x80, max = 0xbf;
+    if (p[0] < 0x80) return 1;
+    if (p[0] < 0xc2) return 0;
+    if (p[0] < 0xe0){
+        n = 2;
+        // U+0080 to U+009F are the C1 control characters
+        if (p[0] == 0xc2) min = 0xa0;
+    }else if (p[0] < 0xf0){
+        n = 3;
+        if (p[0] == 0xe0) min = 0xa0;
+        if (p[0] == 0xed) max = 0x9f;
+    }else if (p[0] < 0xf5){
+        n = 4;
+        if (p[0] == 0xf0) min = 0x90;
+        if (p[0] == 0xf4) max = 0x8f;
+    }else{
+        return 0;
+    }
+    if (len < n || p[1] < min || p[1] > max) return 0;
+    for (j = 2; j < n; j++){
+        if ((p[j] & 0xc0) != 0x80) return 0;
+    }
+    return n;
+}
+
+// We look at the characters of a row to know which render kernel it needs
+void rowClassify(erow *row){
+    int j = 0;
+    row->flags = memchr(row->chars, '\t', row->size) ? ROW_HAS_TABS : 0;
+    while (j < row->size){
+        unsigned char c = row->chars[j];
+        if (c == '\t' || (c >= 0x20 && c < 0x7f)){
+            j++;
+            continue;
+        }
+        // Control characters and bytes that are not valid UTF-8 have to be escaped
+        int n = c < 0x80 ? 0 : utf8Length(&row->chars[j], row->size - j);
+        if (n == 0){
+            row->flags |= ROW_HAS_ESCAPES;
+            break;
+        }
+        j += n;
+    }
+}
+
+// We get the position of the character in row->chars that is rendered on the rx column
+int rowRxToCx(erow *row, int rx){
+    int cur_rx = 0;
+    int cx;
+    // Without tabs every character takes one column
+    if (!(row->flags & ROW_HAS_TABS)) return rx < row->size ? rx : row->size;
+    for (cx = 0; cx < row->size; cx++){
+        // We advance cur_rx the same way rowCxToRx does
+        if (row->chars[cx] == '\t')
+            cur_rx += (E.tabstop-1) - (cur_rx % E.tabstop);
+        cur_rx++;
+        // When we go past rx we found the character
+        if (cur_rx > rx) return cx;
+    }
+    return cx;
+}
+
+// We make sure the render of the row has space for 'needed' bytes
+// We only get a new block if the render doesnt fit in the one we have
+void rowReserveRender(erow *row, int needed){
+    if (row->rcap >= needed) return;
+    size_t got;
+    E.file.renderbytes -= row->rcap;
+    rowFreeRender(row);
+    row->render = poolAlloc(needed, &got);
+    row->rcap = got;
+    E.file.renderbytes += got;
+}
+
+// Render kernels. updateRow picks one for every row depending on its flags
+
+// Rows without tabs or control characters look the same on screen, the render is the characters themselves
+void renderPlain(erow *row){
+    E.file.renderbytes -= row->rcap;
+    rowFreeRender(row);
+    row->render = row->chars;
+    row->rsize = row->size;
+}
+
+// Rows with tabs. We jump from tab to tab with memchr and copy the text between them in blocks
+void renderTabs(erow *row){
+    const char *p = row->chars;
+    const char *end = row->chars + row->size;
+    const char *tab;
+    int tabs = 0;
+    // We count the number of tabs on the row
+    while ((tab = memchr(p, '\t', end - p)) != NULL){
+        tabs++;
+        p = tab + 1;
+    }
+
+    // We need space to hold the whole row on the render var and tabstop-1 more bytes for each tab
+    rowReserveRender(row, row->size + tabs*(E.tabstop-1) + 1);
+
+    int idx = 0;
+    p = row->chars;
+    while ((tab = memchr(p, '\t', end - p)) != NULL){
+        // We copy the text before the tab
+        memcpy(&row->render[idx], p, tab - p);
+        idx += tab - p;
+        // We write spaces until the next column that is divisible by the tab stop
+        do row->render[idx++] = ' '; while (idx % E.tabstop != 0);
+        p = tab + 1;
+    }
+    // We copy the text after the last tab
+    memcpy(&row->render[idx], p, end - p);
+    idx += end - p;
+
+    row->render[idx] = '\0';
+    row->rsize = idx;
+}
+
+// Rows with control characters or bytes that are not valid UTF-8. We go character by character, expanding tabs
+// Every byte of a control character or of a sequence that is not valid UTF-8 is shown as '?', writing them to the terminal would mess up the screen
+// Valid UTF-8 characters are copied as they are
+void renderEscaped(erow *row){
     int tabs = 0;
     int j;
     // We count the number of tabs on the row
     for (j=0; j<row->size; j++){
         if (row->chars[j] == '\t') tabs ++;
     }
-
-    // We empty the contents of the render variable inside this row
-    free(row->render);
-
-    // We allocate the space to hold the whole row on the render var and add the space for 7 (which is TONNE_TAB_STOP-1) more bytes for each tab
-    row->render = malloc(row->size + tabs*(TONNE_TAB_STOP-1) + 1);
+    rowReserveRender(row, row->size + tabs*(E.tabstop-1) + 1);
 
     // We copy the values from the row chars to the row render var
     int idx = 0;
-    for (j=0;j<row->size;j++){
+    j = 0;
+    while (j < row->size){
+        unsigned char c = row->chars[j];
         // If we are copying a tab characer
-        if (row->chars[j] == '\t'){
-            // We instead write the tab as spaces spaces
+        if (c == '\t'){
+            // We instead write the tab as spaces until the next tab stop
             row->render[idx++] = ' ';
-            // We write spaces until the next column that is divisible by TONNE_TAB_STOP(8)
-            while (idx%TONNE_TAB_STOP != 0) row->render[idx++] = ' ';
+            while (idx%E.tabstop != 0) row->render[idx++] = ' ';
+            j++;
+            continue;
+        }
+        // n is the length of the character, or 0 if it has to be escaped
+        int n = c >= 0x80 ? utf8Length(&row->chars[j], row->size - j) : rowCharClass(c) ? 0 : 1;
+        if (n == 0){
+            row->render[idx++] = '?';
+            j++;
         }else{
             // otherwise, if the character is not rendered differently, we just copy it
-            row->render[idx++] = row->chars[j];
+            memcpy(&row->render[idx], &row->chars[j], n);
+            idx += n;
+            j += n;
         }
-
     }
 
     // We set the last value of the render var to a zero byte
     row->render[idx] = '\0';
     // we set rsize to the length of the render var
     row->rsize = idx;
+}
+
+void updateRow(erow *row){
+
+    // We choose the render kernel with the flags of the row
+    if (row->flags & ROW_HAS_ESCAPES){
+        renderEscaped(row);
+    }else if (row->flags & ROW_HAS_TABS){
+        renderTabs(row);
+    }else{
+        renderPlain(row);
+    }
+
+    // If the wrap layout is up to date we only update the number of lines of this row
+    if (E.file.wrapcols == E.screencols){
+        int lines = wrapRowLines(row);
+        int at = row - E.file.row;
+        // appendRow updates the row before it is counted in E.file.numrows, wrapTreeAppend adds it later
+        if (at < E.file.numrows) wrapTreeAdd(at, lines - row->wraplines);
+        row->wraplines = lines;
+    }
 
 }
 
-void appendRow(char *s, size_t len){
+// Every row but the last one ends in a newline. If the row at 'at' is not the last one and has none, it gets the line break of a row next to it
+void rowEnsureLineBreak(int at){
+    if (at < 0 || at >= E.file.numrows - 1 || E.file.row[at].eolnl) return;
+    erow *row = &E.file.row[at];
+    statsAddRow(row, -1);
+    erow *model = E.file.row[at + 1].eolnl ? &E.file.row[at + 1] : at > 0 ? &E.file.row[at - 1] : NULL;
+    if (row->eolcr == 0 && model) row->eolcr = model->eolcr;
+    row->eolnl = 1;
+    statsAddRow(row, 1);
+    statsRowChanged(at);
+}
+
+// We add a row at the end of the file. eolcr and eolnl are the line break it had in the file
+void appendRow(char *s, size_t len, int eolcr, int eolnl){
 
     // We allocate enough space for the rows we need to write
-    // We make E.row pointer point to the start of this block of memory
+    // We make E.file.row pointer point to the start of this block of memory
     // TODO if erow is a struct, why does sizeof know its size? what is going on there?
-    E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
+    E.file.row = realloc(E.file.row, sizeof(erow) * (E.file.numrows + 1));
 
     // We create an int to hold the index of the new row we are appending
-    int at = E.numrows;
+    int at = E.file.numrows;
 
     // We set the length of this row
     // We set the size of the row to be written
-    E.row[at].size = len;
+    E.file.row[at].size = len;
 
     // We allocate the memory to hold all characters for this line
     // It is the length of the string read plus one for the 0 byte so it is interpreted as a string
-    E.row[at].chars = malloc(len + 1);
+    E.file.row[at].chars = rowCharsAlloc(len + 1);
 
-    // We move len number of bytes from the pointer 's' onwards into E.row.chars
-    memcpy(E.row[at].chars, s, len);
+    // We move len number of bytes from the pointer 's' onwards into E.file.row.chars
+    memcpy(E.file.row[at].chars, s, len);
 
     // We set the last character to a zero byte so it is interpreted as a string and not just as a collection of bytes
-    E.row[at].chars[len] = '\0';
+    E.file.row[at].chars[len] = '\0';
+    E.file.charbytes += len + 1;
 
 
     //We initialize the values for the special character rendering variables
-    E.row[at].rsize = 0;
-    E.row[at].render = NULL;
-    updateRow(&E.row[at]);
+    E.file.row[at].rsize = 0;
+    E.file.row[at].render = NULL;
+    E.file.row[at].rcap = 0;
+    E.file.row[at].wraplines = 0;
+    E.file.row[at].eolcr = eolcr;
+    E.file.row[at].eolnl = eolnl;
+    rowClassify(&E.file.row[at]);
+    updateRow(&E.file.row[at]);
+
+    // We add the row to the statistics
+    rowCountStats(&E.file.row[at]);
+    statsAddRow(&E.file.row[at], 1);
 
     // We increment the counter for the number of rows
-    E.numrows++;
+    E.file.numrows++;
+    statsInsertRows(at, 1);
+
+    // We add the new row to the wrap layout if it is in use
+    if (E.file.wrapcols == E.screencols) wrapTreeAppend();
 
 }
 
+// We replace 'remove' rows starting at 'at' with the n rows in 'rows'
+// The rows in the array are moved to the file, the rows removed are freed
+void spliceRows(int at, int remove, erow *rows, int n){
+    int i;
+    for (i = at; i < at + remove; i++){
+        E.file.charbytes -= E.file.row[i].size + 1;
+        statsAddRow(&E.file.row[i], -1);
+        if (E.file.row[i].render) E.file.renderbytes -= E.file.row[i].rcap;
+        freeRow(&E.file.row[i]);
+    }
+    if (n > remove) E.file.row = realloc(E.file.row, sizeof(erow) * (E.file.numrows - remove + n));
+    memmove(&E.file.row[at + n], &E.file.row[at + remove], sizeof(erow) * (E.file.numrows - at - remove));
+    if (n) memcpy(&E.file.row[at], rows, sizeof(erow) * n);
+    E.file.numrows += n - remove;
+    for (i = at; i < at + n; i++){
+        E.file.charbytes += E.file.row[i].size + 1;
+        statsAddRow(&E.file.row[i], 1);
+        if (E.file.row[i].render) E.file.renderbytes += E.file.row[i].rcap;
+    }
+    // The rows after 'at' moved so we rebuild that part of the wrap layout
+    wrapTreeSplice(at, n);
+    statsRemoveRows(at, remove);
+    statsInsertRows(at, n);
+}
+
 void insertCharToRow(erow *row, int at, int c){
 
     // We cap the position of the position we can add characters
     if (at < 0 || at > row->size) at = row->size;
-    // We add 2 bytes to the string (one for the new character and one for the nullbyte)(row.size doesnt account for the nullbyte but the memory allocation does)
-    row->chars = realloc(row->chars, row->size+2);
+
+    // We update the word count looking only at the characters around the new one
+    // A word character between 2 spaces starts a word, a space between 2 word characters splits one
+    int wordbefore = at > 0 && isWordChar(row->chars[at-1]);
+    int wordafter = at < row->size && isWordChar(row->chars[at]);
+    int words = isWordChar(c) ? (!wordbefore && !wordafter) : (wordbefore && wordafter);
+    int nchars = isCharStart(c);
+    row->words += words;
+    row->nchars += nchars;
+    row->flags |= rowCharClass((unsigned char)c);
+    E.file.words += words;
+    E.file.nchars += nchars;
+    statsRowChanged(row - E.file.row);
+
+    // If the characters are shared with the clipboard we get our own copy first
+    rowMakeWritable(row);
+    // We need 2 more bytes on the string (one for the new character and one for the nullbyte)(row.size doesnt account for the nullbyte but the memory allocation does)
+    // We only move the row to a bigger block when it is full, the blocks grow geometrically
+    if (ROW_CHARS_HEADER(row->chars)->cap < row->size + 2){
+        char *bigger = rowCharsAlloc(row->size + 2);
+        memcpy(bigger, row->chars, row->size + 1);
+        rowCharsRelease(row->chars);
+        row->chars = bigger;
+    }
     // move the characters from "at" position to the end of the row one position forward
     memmove(&row->chars[at+1], &row->chars[at], row->size - at + 1);
     // we increase the var hoilding the size of the row
     row->size++;
     // We set the character at the "at" position to the value of "c"
     row->chars[at] = c;
+    E.file.charbytes++;
+    E.file.filebytes++;
+    E.file.dirty++;
     // We update the display of the row
     updateRow(row);
 
-}
+}
+
+
+/*** editor operations ***/
+
+void insertChar(int c){
+
+    // If the cursor is at the end of the file
+    if (E.file.cy == E.file.numrows){
+        // We add a new line at the end. The row before it isnt the last one anymore so it needs a line break
+        appendRow("", 0, 0, 0);
+        rowEnsureLineBreak(E.file.numrows - 2);
+    }
+    // We add the character on the row we are in
+    insertCharToRow(&E.file.row[E.file.cy], E.file.cx, c);
+    // We move the cursor forward
+    E.file.cx++;
+
+}
+
+
+/*** hex view ***/
+
+// We look for a zero byte at the start of the file. Text files dont have them, binary files almost always do
+int isBinaryFile(FILE *fp){
+    char buf[BINARY_PROBE_SIZE];
+    size_t n = fread(buf, 1, sizeof(buf), fp);
+    // We go back to the start so the file can still be read as text
+    rewind(fp);
+    return memchr(buf, '\0', n) != NULL;
+}
+
+// We map the file in memory to show it in the hex view
+void hexOpen(char *filename){
+    // We try to open the file for writing so the edits can be saved, if we cant we still show it
+    E.file.hex.readonly = 0;
+    E.file.hex.fd = open(filename, O_RDWR);
+    if (E.file.hex.fd == -1){
+        E.file.hex.readonly = 1;
+        E.file.hex.fd = open(filename, O_RDONLY);
+    }
+    if (E.file.hex.fd == -1) die("open");
+
+    struct stat st;
+    if (fstat(E.file.hex.fd, &st) == -1) die("fstat");
+    E.file.hex.size = st.st_size;
+
+    // The mapping is private, writing to it doesnt change the file until we save
+    // The kernel only loads the pages we look at and only copies the pages we write to
+    E.file.hex.map = mmap(NULL, E.file.hex.size, PROT_READ | PROT_WRITE, MAP_PRIVATE, E.file.hex.fd, 0);
+    if (E.file.hex.map == MAP_FAILED) die("mmap");
+
+    // We use the same number of digits on every line so the columns line up
+    E.file.hex.offsetdigits = HEX_MIN_OFFSET_DIGITS;
+    while (E.file.hex.offsetdigits < HEX_MAX_OFFSET_DIGITS && ((E.file.hex.size - 1) >> (E.file.hex.offsetdigits * 4)) != 0)
+        E.file.hex.offsetdigits++;
+
+    E.file.hex.offset = 0;
+    E.file.hex.cursor = 0;
+    E.file.hex.nibble = 0;
+    E.file.hex.numdirty = 0;
+}
+
+// We add the page of the byte at 'pos' to the list of changed pages
+void hexMarkDirty(size_t pos){
+    size_t page = pos / sysconf(_SC_PAGESIZE);
+
+    // We look for the page in the sorted list with a binary search
+    int lo = 0, hi = E.file.hex.numdirty;
+    while (lo < hi){
+        int mid = (lo + hi) / 2;
+        if (E.file.hex.dirty[mid] < page) lo = mid + 1;
+        else hi = mid;
+    }
+    // If it is already there we are done
+    if (lo < E.file.hex.numdirty && E.file.hex.dirty[lo] == page) return;
+
+    if (E.file.hex.numdirty == E.file.hex.dirtycap){
+        E.file.hex.dirtycap = E.file.hex.dirtycap ? E.file.hex.dirtycap * 2 : 16;
+        E.file.hex.dirty = realloc(E.file.hex.dirty, sizeof(size_t) * E.file.hex.dirtycap);
+    }
+    // We make space for the page and insert it keeping the list sorted
+    memmove(&E.file.hex.dirty[lo+1], &E.file.hex.dirty[lo], sizeof(size_t) * (E.file.hex.numdirty - lo));
+    E.file.hex.dirty[lo] = page;
+    E.file.hex.numdirty++;
+}
+
+// We write the changed pages back to the file
+void hexSave(){
+    if (E.file.hex.readonly){
+        setStatusMessage("Can't save, the file is read only");
+        return;
+    }
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    int i;
+    for (i = 0; i < E.file.hex.numdirty; i++){
+        size_t off = E.file.hex.dirty[i] * pagesize;
+        size_t len = E.file.hex.size - off < pagesize ? E.file.hex.size - off : pagesize;
+        if (pwrite(E.file.hex.fd, E.file.hex.map + off, len, off) != (ssize_t)len){
+            setStatusMessage("Can't save! I/O error: %s", strerror(errno));
+            return;
+        }
+        // The file has the same bytes now, we drop our private copy of the page so the kernel can free it
+        madvise(E.file.hex.map + off, len, MADV_DONTNEED);
+    }
+    setStatusMessage("%d pages written to disk", E.file.hex.numdirty);
+    E.file.hex.numdirty = 0;
+}
+
+// We overwrite half of the byte under the cursor with the hex digit typed
+void hexOverwrite(int digit){
+    if (E.file.hex.readonly){
+        setStatusMessage("The file is read only");
+        return;
+    }
+    unsigned char *byte = &E.file.hex.map[E.file.hex.cursor];
+    if (E.file.hex.nibble == 0){
+        // We write the high half and stay on the byte
+        *byte = (digit << 4) | (*byte & 0x0f);
+        E.file.hex.nibble = 1;
+    }else{
+        // We write the low half and move to the next byte
+        *byte = (*byte & 0xf0) | digit;
+        E.file.hex.nibble = 0;
+        if (E.file.hex.cursor + 1 < E.file.hex.size) E.file.hex.cursor++;
+    }
+    hexMarkDirty(byte - E.file.hex.map);
+}
+
+
+/*** clipboard ***/
+
+// We empty the clipboard, the rows that share its characters keep them
+void clipboardClear(){
+    int i;
+    for (i = 0; i < E.cliplen; i++) freeRow(&E.clip[i]);
+    E.cliplen = 0;
+}
+
+// The tab stop changed. We drop the renders of the clipboard rows with tabs and measure them again so they are right when pasted
+// The clipboard renders are not counted in renderbytes
+void clipboardRetab(){
+    int i;
+    for (i = 0; i < E.cliplen; i++){
+        erow *row = &E.clip[i];
+        if (!(row->flags & ROW_HAS_TABS)) continue;
+        rowFreeRender(row);
+        row->rsize = rowCxToRx(row, row->size);
+    }
+}
+
+// We make sure the clipboard has space for n rows
+void clipboardReserve(int n){
+    if (E.clipcap >= n) return;
+    E.clipcap = n;
+    E.clip = realloc(E.clip, sizeof(erow) * E.clipcap);
+}
+
+// We get the rows selected for cut or copy, from the mark to the cursor
+// If there is no mark it is only the row of the cursor. It returns 0 if there is nothing to select
+int selectedRows(int *at, int *n){
+    if (E.file.cy >= E.file.numrows) return 0;
+    int first = E.file.cy, last = E.file.cy;
+    if (E.file.markrow != -1){
+        int mark = E.file.markrow < E.file.numrows ? E.file.markrow : E.file.numrows - 1;
+        if (mark < first) first = mark;
+        if (mark > last) last = mark;
+    }
+    *at = first;
+    *n = last - first + 1;
+    return 1;
+}
+
+// We copy n rows starting at 'at' to the clipboard
+// Only the descriptors are copied, the characters are shared and copied only if one side changes them
+void copyRows(int at, int n){
+    int i;
+    clipboardClear();
+    clipboardReserve(n);
+    for (i = 0; i < n; i++){
+        E.clip[i] = E.file.row[at + i];
+        rowCharsRetain(E.clip[i].chars);
+        // The render is a cache of the file, the clipboard doesnt need it
+        E.clip[i].render = NULL;
+        E.clip[i].rcap = 0;
+    }
+    E.cliplen = n;
+}
+
+// We move n rows starting at 'at' to the clipboard
+// The descriptors are moved as they are, nothing is copied or freed
+void cutRows(int at, int n){
+    int i;
+    clipboardClear();
+    clipboardReserve(n);
+    memcpy(E.clip, &E.file.row[at], sizeof(erow) * n);
+    E.cliplen = n;
+
+    // We close the gap left by the rows
+    memmove(&E.file.row[at], &E.file.row[at + n], sizeof(erow) * (E.file.numrows - at - n));
+    E.file.numrows -= n;
+    for (i = 0; i < n; i++){
+        E.file.charbytes -= E.clip[i].size + 1;
+        statsAddRow(&E.clip[i], -1);
+        if (E.clip[i].render) E.file.renderbytes -= E.clip[i].rcap;
+    }
+    // Rows moved so we rebuild the wrap layout after them
+    wrapTreeSplice(at, 0);
+    statsRemoveRows(at, n);
+    E.file.dirty++;
+}
+
+// We insert the rows of the clipboard before the row at 'at'
+// The rows share their characters with the clipboard so we can paste again
+void pasteRows(int at){
+    int i, n = E.cliplen;
+    E.file.row = realloc(E.file.row, sizeof(erow) * (E.file.numrows + n));
+    // We open a gap for the new rows
+    memmove(&E.file.row[at + n], &E.file.row[at], sizeof(erow) * (E.file.numrows - at));
+    memcpy(&E.file.row[at], E.clip, sizeof(erow) * n);
+    E.file.numrows += n;
+    for (i = 0; i < n; i++){
+        rowCharsRetain(E.clip[i].chars);
+        // Cut rows still have their render, we give it to the file since the clipboard doesnt need it
+        // Rows without a render get one when they are drawn
+        E.clip[i].render = NULL;
+        E.clip[i].rcap = 0;
+        E.file.charbytes += E.file.row[at + i].size + 1;
+        statsAddRow(&E.file.row[at + i], 1);
+        if (E.file.row[at + i].render) E.file.renderbytes += E.file.row[at + i].rcap;
+    }
+    wrapTreeSplice(at, n);
+    statsInsertRows(at, n);
+    // A row that was the last one of the file can be pasted in the middle, and the rows can be pasted after the last one
+    rowEnsureLineBreak(at + n - 1);
+    rowEnsureLineBreak(at - 1);
+    E.file.dirty++;
+}
+
+
+/*** file watcher ***/
+
+// We find the line that starts at 'pos'. We set *len to its length without the line break and return where the next line starts
+// Lines are split the same way getline does, and a last line without a line break is still a line
+size_t nextLine(const char *map, size_t pos, size_t end, size_t *len){
+    const char *nl = memchr(map + pos, '\n', end - pos);
+    size_t stop = nl ? (size_t)(nl - map) : end;
+    *len = stop - pos;
+    // We strip the carriage returns since we wont display them
+    while (*len > 0 && map[pos + *len - 1] == '\r') (*len)--;
+    return nl ? stop + 1 : end;
+}
+
+// Work for one of the threads that scan the file
+typedef struct scanjob {
+    const char *map;
+    size_t size;
+    int first, last;
+    filechunk *chunks;
+    // Number of line breaks in every chunk, and the offset of the last one (or -1)
+    int *newlines;
+    long long *lastnewline;
+} scanjob;
+
+// We hash the chunks of a job and count their line breaks
+void *scanChunks(void *arg){
+    scanjob *job = arg;
+    int c;
+    for (c = job->first; c < job->last; c++){
+        size_t start = (size_t)c * WATCH_CHUNK_SIZE;
+        size_t end = start + WATCH_CHUNK_SIZE < job->size ? start + WATCH_CHUNK_SIZE : job->size;
+        const char *p = job->map + start;
+        const char *stop = job->map + end;
+
+        job->chunks[c].hash = hashBytes(p, end - start, HASH_SEED);
+        job->newlines[c] = 0;
+        job->lastnewline[c] = -1;
+        while ((p = memchr(p, '\n', stop - p)) != NULL){
+            job->newlines[c]++;
+            job->lastnewline[c] = p - job->map;
+            p++;
+        }
+    }
+    return NULL;
+}
+
+// We make the chunk table of a file: the hash of every chunk and the row its first byte is on
+// Big files are split between several threads. It returns the number of chunks
+int scanFile(const char *map, size_t size, filechunk **out){
+    int numchunks = (size + WATCH_CHUNK_SIZE - 1) / WATCH_CHUNK_SIZE;
+    filechunk *chunks = malloc(sizeof(filechunk) * (numchunks + 1));
+    int *newlines = malloc(sizeof(int) * (numchunks + 1));
+    long long *lastnewline = malloc(sizeof(long long) * (numchunks + 1));
+
+    int numthreads = 1;
+    if (size >= WATCH_PARALLEL_MIN){
+        numthreads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (numthreads > WATCH_MAX_THREADS) numthreads = WATCH_MAX_THREADS;
+        if (numthreads > numchunks) numthreads = numchunks;
+        if (numthreads < 1) numthreads = 1;
+    }
+
+    scanjob jobs[WATCH_MAX_THREADS];
+    pthread_t threads[WATCH_MAX_THREADS];
+    int t;
+    for (t = 0; t < numthreads; t++){
+        jobs[t].map = map;
+        jobs[t].size = size;
+        jobs[t].first = (long long)numchunks * t / numthreads;
+        jobs[t].last = (long long)numchunks * (t + 1) / numthreads;
+        jobs[t].chunks = chunks;
+        jobs[t].newlines = newlines;
+        jobs[t].lastnewline = lastnewline;
+    }
+    // The first job runs on this thread. If a thread cant be started we do its job here too
+    for (t = 1; t < numthreads; t++){
+        if (pthread_create(&threads[t], NULL, scanChunks, &jobs[t]) != 0){
+            scanChunks(&jobs[t]);
+            threads[t] = 0;
+        }
+    }
+    scanChunks(&jobs[0]);
+    for (t = 1; t < numthreads; t++){
+        if (threads[t]) pthread_join(threads[t], NULL);
+    }
+
+    // With the line breaks of every chunk we find the row each chunk starts on
+    // The extra entry at the end is the row that contains the end of the file
+    int row = 0;
+    size_t rowstart = 0;
+    int c;
+    for (c = 0; c <= numchunks; c++){
+        chunks[c].row = row;
+        chunks[c].rowstart = rowstart;
+        if (c == numchunks) break;
+        row += newlines[c];
+        if (lastnewline[c] != -1) rowstart = lastnewline[c] + 1;
+    }
+    chunks[numchunks].hash = 0;
+
+    free(newlines);
+    free(lastnewline);
+    *out = chunks;
+    return numchunks;
+}
+
+// We check if the file changed on disk since we read it. It only calls stat, and only every WATCH_INTERVAL seconds
+int watchPoll(){
+    if (E.file.filename == NULL || E.file.hex.map || E.file.chunks == NULL) return 0;
+    time_t now = time(NULL);
+    if (now - E.file.watchtime < WATCH_INTERVAL) return 0;
+    E.file.watchtime = now;
+
+    struct stat st;
+    // If the file is gone (like when a log is rotated) we keep what we have until a new one appears
+    if (stat(E.file.filename, &st) == -1) return 0;
+    return st.st_size != E.file.filestat.st_size || st.st_ino != E.file.filestat.st_ino || st.st_dev != E.file.filestat.st_dev ||
+        st.st_mtim.tv_sec != E.file.filestat.st_mtim.tv_sec || st.st_mtim.tv_nsec != E.file.filestat.st_mtim.tv_nsec;
+}
+
+// The file changed on disk. We hash it again and only read the rows of the chunks that changed
+// The rest of the rows, and their renders, are kept as they are
+void watchReload(){
+    // If we have changes we cant read the file without losing them, we warn the user instead
+    if (E.file.dirty){
+        stat(E.file.filename, &E.file.filestat);
+        setStatusMessage("WARNING: %.40s changed on disk, it conflicts with your changes", E.file.filename);
+        return;
+    }
+
+    int fd = open(E.file.filename, O_RDONLY);
+    if (fd == -1) return;
+    struct stat st;
+    if (fstat(fd, &st) == -1){
+        close(fd);
+        return;
+    }
+    size_t size = st.st_size;
+    char *map = NULL;
+    if (size > 0){
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED){
+            close(fd);
+            return;
+        }
+    }
+
+    filechunk *chunks;
+    int numchunks = scanFile(map, size, &chunks);
+
+    // We look for the first chunk that is different
+    int common = numchunks < E.file.numchunks ? numchunks : E.file.numchunks;
+    int first = 0;
+    while (first < common && chunks[first].hash == E.file.chunks[first].hash) first++;
+
+    size_t start = 0, end = size;
+    int firstrow = 0, lastrow = E.file.numrows;
+    if (size == (size_t)E.file.filestat.st_size && first == common){
+        // Nothing changed, the file was only touched
+        end = start;
+        firstrow = lastrow;
+    }else{
+        // We start on the row that contains the first byte of the chunk. It starts after a line break of a chunk that didnt change
+        start = E.file.chunks[first].rowstart;
+        firstrow = E.file.chunks[first].row;
+
+        // If the size is the same the chunks after the last changed one are the same too, we only read up to them
+        if (size == (size_t)E.file.filestat.st_size){
+            int last = common - 1;
+            while (chunks[last].hash == E.file.chunks[last].hash) last--;
+            if (last + 1 < numchunks){
+                // The rows end after the first line break of the next chunk, everything after it is the same
+                size_t from = (size_t)(last + 1) * WATCH_CHUNK_SIZE;
+                char *nl = memchr(map + from, '\n', size - from);
+                if (nl){
+                    end = nl - map + 1;
+                    lastrow = E.file.chunks[last + 1].row + 1;
+                }
+            }
+        }
+    }
+
+    // We read the rows of the part that changed. They are rendered when they are drawn
+    erow *rows = NULL;
+    int n = 0, cap = 0;
+    size_t pos = start;
+    while (pos < end){
+        size_t len;
+        size_t linestart = pos;
+        pos = nextLine(map, pos, end, &len);
+        int newline = map[pos - 1] == '\n';
+        if (n == cap){
+            cap = cap ? cap * 2 : 64;
+            rows = realloc(rows, sizeof(erow) * cap);
+        }
+        erow *row = &rows[n++];
+        row->size = len;
+        row->chars = rowCharsAlloc(len + 1);
+        memcpy(row->chars, map + linestart, len);
+        row->chars[len] = '\0';
+        row->render = NULL;
+        row->rcap = 0;
+        rowClassify(row);
+        row->rsize = rowCxToRx(row, len);
+        row->wraplines = 0;
+        row->eolcr = pos - linestart - len - newline;
+        row->eolnl = newline;
+        rowCountStats(row);
+    }
+    spliceRows(firstrow, lastrow - firstrow, rows, n);
+    free(rows);
+
+    // The cursor stays on the same text if it was after the rows that changed
+    if (E.file.cy >= lastrow) E.file.cy += n - (lastrow - firstrow);
+    if (E.file.cy > E.file.numrows) E.file.cy = E.file.numrows;
+    if (E.file.cy < E.file.numrows && E.file.cx > E.file.row[E.file.cy].size) E.file.cx = E.file.row[E.file.cy].size;
+    if (E.file.cy == E.file.numrows) E.file.cx = 0;
+    E.file.markrow = -1;
+
+    free(E.file.chunks);
+    E.file.chunks = chunks;
+    E.file.numchunks = numchunks;
+    E.file.filestat = st;
+    if (map) munmap(map, size);
+    close(fd);
+
+    if (n || lastrow - firstrow) setStatusMessage("%.40s changed on disk, reloaded %d lines", E.file.filename, n);
+}
+
+
+/*** file i/o ***/
+
+// We read the file line by line. It is used for files we cant map, like pipes or the files in /proc that say they are empty
+void readFileLines(FILE *fp){
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    while ((linelen = getline(&line, &linecap, fp)) != -1){
+        // We strip the line breaks and carriage return from the string since we wont display them
+        // We remember them so the size and the checksum are the ones of the file
+        ssize_t full = linelen;
+        int newline = line[full-1] == '\n';
+        while (linelen > 0 && (line[linelen-1] == '\n' || line[linelen-1] == '\r')) linelen--;
+        appendRow(line, linelen, full - linelen - newline, newline);
+    }
+    free(line);
+}
+
+void openFile(char *filename){
+    // We save the filename to a string
+    // We copy it before freeing the old one since we can be reloading E.file.filename itself
+    char *name = strdup(filename);
+    free(E.file.filename);
+    E.file.filename = name;
+
+    // We create a pointer to the file chosen
+    // TODO research what `FILE` is
+    FILE *fp = fopen(E.file.filename, "r");
+    if (!fp) die("fopen");
+    if (fstat(fileno(fp), &E.file.filestat) == -1) die("fstat");
+
+    free(E.file.chunks);
+    E.file.chunks = NULL;
+    E.file.numchunks = 0;
+
+    // Files without a size cant be mapped, we read them like a stream
+    // Pipes and files in /proc cant be watched, an empty regular file can since its size changes when it is written
+    if (!S_ISREG(E.file.filestat.st_mode) || E.file.filestat.st_size == 0){
+        readFileLines(fp);
+        if (S_ISREG(E.file.filestat.st_mode) && E.file.numrows == 0){
+            E.file.numchunks = scanFile(NULL, 0, &E.file.chunks);
+            E.file.watchtime = time(NULL);
+        }
+        fclose(fp);
+        E.file.dirty = 0;
+        return;
+    }
+
+    // Binary files are not split in rows, we show them on the hex view
+    if (isBinaryFile(fp)){
+        fclose(fp);
+        hexOpen(E.file.filename);
+        return;
+    }
+
+    // We map the file in memory and split it in rows from there
+    // That way the chunk hashes we keep to watch the file are made from the same bytes as the rows
+    size_t size = E.file.filestat.st_size;
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (map == MAP_FAILED) die("mmap");
+
+    size_t pos = 0;
+    while (pos < size){
+        size_t len;
+        size_t linestart = pos;
+        pos = nextLine(map, pos, size, &len);
+        int newline = map[pos - 1] == '\n';
+        // We then add the row to the buffer
+        appendRow(map + linestart, len, pos - linestart - len - newline, newline);
+    }
 
+    E.file.numchunks = scanFile(map, size, &E.file.chunks);
+    E.file.watchtime = time(NULL);
 
-/*** editor operations ***/
+    munmap(map, size);
+    fclose(fp);
+    // Loading the file doesnt count as a change
+    E.file.dirty = 0;
+}
 
-void insertChar(int c){
 
-    // If the cursor is at the end of the file
-    if (E.cy == E.numrows){
-        // We add a new line at the end
-        appendRow("", 0);
+// The tab stop changed. Only rows with tabs look different, we drop their renders and they are made again when drawn
+// Rows without tabs keep their render
+void retabRows(){
+    int i;
+    for (i = 0; i < E.file.numrows; i++){
+        erow *row = &E.file.row[i];
+        if (!(row->flags & ROW_HAS_TABS)) continue;
+        E.file.renderbytes -= row->rcap;
+        rowFreeRender(row);
+        row->rsize = rowCxToRx(row, row->size);
     }
-    // We add the character on the row we are in
-    insertCharToRow(&E.row[E.cy], E.cx, c);
-    // We move the cursor forward
-    E.cx++;
+    E.file.rowtabstop = E.tabstop;
+    // The width of the rows changed so the wrap layout has to be built again
+    E.file.wrapcols = 0;
+}
+
 
+/*** buffers ***/
+
+// We set the state of a file in E to an empty file
+void resetBufferState(){
+    memset(&E.file, 0, sizeof(E.file));
+    E.file.markrow = -1;
+    E.file.checksumstale = 1;
+    E.file.rowtabstop = E.tabstop;
 }
 
+// We move the state of the active file from E to its buffer slot
+void bufferSave(ebuffer *b){
+    b->file = E.file;
+    b->lastused = E.bufferclock++;
+}
 
-/*** file i/o ***/
+// We move the state of a buffer to E. If its rows were dropped we read the file again
+void bufferLoad(ebuffer *b){
+    E.file = b->file;
+    E.file.markrow = -1;
+    // We check the file on disk right away in case it changed while the buffer was inactive
+    E.file.watchtime = 0;
+
+    if (b->evicted){
+        b->evicted = 0;
+        // We dont die if the file was deleted or cant be read anymore, the buffer stays empty
+        // We forget the chunks of the old file so the watcher doesnt compare a new file with rows we dont have
+        if (access(E.file.filename, R_OK) == -1){
+            setStatusMessage("Can't reload %s: %s", E.file.filename, strerror(errno));
+            free(E.file.chunks);
+            E.file.chunks = NULL;
+            E.file.numchunks = 0;
+        }else{
+            openFile(E.file.filename);
+        }
+    }
 
-void openFile(char *filename){
-    // We save the filename to a string
-    free(E.filename);
-    E.filename = strdup(filename);
+    // We keep the cursor where it was, the file could be shorter if we read it again
+    if (E.file.cy > E.file.numrows) E.file.cy = E.file.numrows;
+    if (E.file.cy == E.file.numrows || E.file.cx > E.file.row[E.file.cy].size) E.file.cx = 0;
 
-    // We create a pointer to the file chosen
-    // TODO research what `FILE` is
-    FILE *fp = fopen(filename, "r");
-    if (!fp) die("fopen");
+    // If the tab stop changed while the buffer was inactive its rows with tabs have to be rendered again
+    if (E.file.rowtabstop != E.tabstop) retabRows();
+}
 
-    // Create a pointer 'line' that will hold a reference to the first byte of the line to be written
-    char *line = NULL;
+// We free the renders of an inactive buffer. They are made again by drawRows when the rows are shown
+void bufferDropRenders(ebuffer *b){
+    int i;
+    for (i = 0; i < b->file.numrows; i++){
+        rowFreeRender(&b->file.row[i]);
+    }
+    b->file.renderbytes = 0;
+}
 
-    // We define the line capacity
-    // It will later be set to the amount of memory allocated for the line read
-    size_t linecap = 0;
+// We free all the rows of an inactive buffer that has no changes. They are read from the file when we switch to it
+void bufferDropRows(ebuffer *b){
+    int i;
+    for (i = 0; i < b->file.numrows; i++) freeRow(&b->file.row[i]);
+    free(b->file.row);
+    free(b->file.wraptree);
+    b->file.row = NULL;
+    b->file.numrows = 0;
+    b->file.wraptree = NULL;
+    b->file.wrapcap = 0;
+    b->file.wrapcols = 0;
+    b->file.charbytes = 0;
+    b->file.renderbytes = 0;
+    // The statistics are counted again when the file is read
+    free(b->file.sums);
+    b->file.sums = NULL;
+    b->file.numsums = 0;
+    b->file.sumcap = 0;
+    b->file.filebytes = 0;
+    b->file.words = 0;
+    b->file.nchars = 0;
+    b->file.checksumstale = 1;
+    b->evicted = 1;
+}
 
-    // Define the length of the variable 'line'
-    // We use ssize_t to handle the quantity of bytes on functions like read(). Also to hold the -1 that is returned on error
-    ssize_t linelen;
-    // We set linelen to the size of the line we read (if it is the end of the line it will be set to -1)
-    // We also set the pointer line to the start of the line read
-    // We also put that definition inside the condition for a while loop so we read until we get -1
-    while ((linelen = getline(&line, &linecap, fp)) != -1){
+// We find the least recently used inactive buffer that still has memory we can free
+// If rows is 0 we look for renders, otherwise for rows of buffers without changes
+ebuffer *bufferFindVictim(int rows){
+    ebuffer *victim = NULL;
+    int i;
+    for (i = 0; i < E.numbuffers; i++){
+        ebuffer *b = &E.buffers[i];
+        if (i == E.curbuffer) continue;
+        // Buffers without a file cant be read again, we never drop their rows
+        if (rows ? (b->file.dirty || b->evicted || b->file.hex.map || b->file.filename == NULL) : b->file.renderbytes == 0) continue;
+        if (victim == NULL || b->lastused < victim->lastused) victim = b;
+    }
+    return victim;
+}
 
-        // We strip the line breaks and carriage return from the string since we wont display them
-        while (linelen > 0 && (line[linelen-1] == '\n' || line[linelen-1] == '\r')) linelen--;
-        // We then add the row to the buffer
-        appendRow(line, linelen);
+// We free memory of inactive buffers until all of them fit in the budget
+// First we drop renders since they are cheap to make again, then the rows of files without changes
+void enforceMemoryBudget(){
+    size_t total = E.file.charbytes + E.file.renderbytes;
+    int i;
+    for (i = 0; i < E.numbuffers; i++){
+        if (i != E.curbuffer) total += E.buffers[i].file.charbytes + E.buffers[i].file.renderbytes;
     }
-    free(line);
-    fclose(fp);
+
+    ebuffer *b;
+    int dropped = 0;
+    while (total > E.membudget && (b = bufferFindVictim(0)) != NULL){
+        total -= b->file.renderbytes;
+        bufferDropRenders(b);
+        dropped = 1;
+    }
+    while (total > E.membudget && (b = bufferFindVictim(1)) != NULL){
+        total -= b->file.charbytes;
+        bufferDropRows(b);
+        dropped = 1;
+    }
+    // The freed rows went back to the pool, we return the slabs left empty to the system
+    if (dropped) poolTrim();
+}
+
+// We make the buffer at index 'at' the active one
+void switchBuffer(int at){
+    if (at == E.curbuffer) return;
+    bufferSave(&E.buffers[E.curbuffer]);
+    E.curbuffer = at;
+    bufferLoad(&E.buffers[at]);
+    enforceMemoryBudget();
+}
+
+// We open a file on a new buffer and make it the active one
+void openBuffer(char *filename){
+    E.buffers = realloc(E.buffers, sizeof(ebuffer) * (E.numbuffers + 1));
+    // If there is an active buffer we save it before loading the new file on E
+    if (E.numbuffers > 0){
+        bufferSave(&E.buffers[E.curbuffer]);
+        resetBufferState();
+    }
+    E.curbuffer = E.numbuffers++;
+    E.buffers[E.curbuffer].evicted = 0;
+    openFile(filename);
+    enforceMemoryBudget();
 }
 
 
@@ -475,36 +2136,64 @@ void abFree(struct abuf *ab){
 }
 
 /*** Output ***/
+
+// We get the visual line the cursor is on when soft wrap is on
+int cursorVisualLine(){
+    return wrapTreePrefix(E.file.cy) + E.file.rx / E.screencols;
+}
+
 void scroll(){
-    E.rx = 0;
+    E.file.rx = 0;
     // If we are in a line that is not NONE
-    if (E.cy < E.numrows){
+    if (E.file.cy < E.file.numrows){
         // We set rx to its value according to the number of tabs and the position of the cursor
-        E.rx = rowCxToRx(&E.row[E.cy], E.cx);
+        E.file.rx = rowCxToRx(&E.file.row[E.file.cy], E.file.cx);
+    }
+
+    // On the hex view we scroll by lines of bytes
+    if (E.file.hex.map){
+        size_t line = E.file.hex.cursor / HEX_BYTES_PER_LINE;
+        size_t top = E.file.hex.offset / HEX_BYTES_PER_LINE;
+        if (line < top) top = line;
+        if (line >= top + E.screenrows) top = line - E.screenrows + 1;
+        E.file.hex.offset = top * HEX_BYTES_PER_LINE;
+        return;
+    }
+
+    // With soft wrap we scroll by visual lines and never to the side
+    if (E.softwrap){
+        wrapEnsureLayout();
+        int line = cursorVisualLine();
+        if (line < E.file.vrowoffset) E.file.vrowoffset = line;
+        if (line >= E.file.vrowoffset + E.screenrows) E.file.vrowoffset = line - E.screenrows + 1;
+        E.file.coloffset = 0;
+        // We keep rowoffset on the row at the top of the screen so turning wrap off doesnt jump
+        E.file.rowoffset = wrapTreeFind(E.file.vrowoffset, NULL);
+        return;
     }
 
     // If the cursor is above the first line shown in the editor
-    if (E.cy < E.rowoffset){
+    if (E.file.cy < E.file.rowoffset){
         // We set the offset to the position of the cursor (scroll up)
-        E.rowoffset = E.cy;
+        E.file.rowoffset = E.file.cy;
     }
 
     // if the cursor is lower than the offset and the length of the screen
-    if (E.cy >= E.rowoffset + E.screenrows){
+    if (E.file.cy >= E.file.rowoffset + E.screenrows){
         // we set the offset to the offset +1. (we do it in a convoluded way but thats essentialy what is happening)
-        E.rowoffset = E.cy - E.screenrows + 1;
+        E.file.rowoffset = E.file.cy - E.screenrows + 1;
     }
 
     // If the cursor is to de left of the first character shown in the editor
-    if (E.rx < E.coloffset){
+    if (E.file.rx < E.file.coloffset){
         // We set the offset to the position of the cursor (scroll right)
-        E.coloffset = E.rx;
+        E.file.coloffset = E.file.rx;
     }
 
     // if the cursor is lower than the offset and the length of the screen
-    if (E.rx >= E.coloffset + E.screencols){
+    if (E.file.rx >= E.file.coloffset + E.screencols){
         // we set the offset to the offset + 1 (we do it in a convoluded way but thats essentialy what is happening). Pretty sure i could do coloffset++ and it would work
-        E.coloffset = E.rx - E.screencols + 1;
+        E.file.coloffset = E.file.rx - E.screencols + 1;
     }
 
 
@@ -513,65 +2202,278 @@ void scroll(){
 
 /*** Input ***/
 
+// We show a message on the message bar and let the user type an answer
+// The message must have a %s where the answer is shown. It returns NULL if the user pressed escape
+char *prompt(char *msg){
+    size_t bufsize = 128;
+    char *buf = malloc(bufsize);
+    size_t buflen = 0;
+    buf[0] = '\0';
+
+    while (1){
+        setStatusMessage(msg, buf);
+        refreshScreen();
+
+        int c = readKey();
+        if (c == RESIZE_EVENT){
+            updateWindowSize();
+        // Backspace and delete remove the last character
+        }else if (c == DEL_KEY || c == CTRL_KEY('h') || c == 127){
+            if (buflen != 0) buf[--buflen] = '\0';
+        // Escape cancels the prompt
+        }else if (c == '\x1b'){
+            setStatusMessage("");
+            free(buf);
+            return NULL;
+        // Enter returns the answer if there is one
+        }else if (c == '\r'){
+            if (buflen != 0){
+                setStatusMessage("");
+                return buf;
+            }
+        // Other printable characters are added to the answer
+        }else if (c < 128 && !iscntrl(c)){
+            if (buflen == bufsize - 1){
+                bufsize *= 2;
+                buf = realloc(buf, bufsize);
+            }
+            buf[buflen++] = c;
+            buf[buflen] = '\0';
+        }
+    }
+}
+
+// Keys for the clipboard. It works on whole rows from the mark to the cursor
+void processClipboardKey(int c){
+    int at, n;
+    switch (c){
+        // We set the mark on the row of the cursor, or remove it if it was already there
+        case CTRL_KEY('b'):
+            E.file.markrow = E.file.markrow == E.file.cy ? -1 : E.file.cy;
+            setStatusMessage(E.file.markrow == -1 ? "Mark removed" : "Mark set");
+            break;
+        case CTRL_KEY('c'):
+        case CTRL_KEY('x'):
+            if (!selectedRows(&at, &n)) break;
+            if (c == CTRL_KEY('c')){
+                copyRows(at, n);
+                setStatusMessage("%d lines copied", n);
+            }else{
+                cutRows(at, n);
+                // The cursor stays on the row that took the place of the first cut row
+                E.file.cy = at;
+                E.file.cx = 0;
+                setStatusMessage("%d lines cut", n);
+            }
+            E.file.markrow = -1;
+            break;
+        // We paste the rows above the row of the cursor
+        case CTRL_KEY('v'):
+            if (E.cliplen == 0) break;
+            pasteRows(E.file.cy);
+            E.file.cx = 0;
+            setStatusMessage("%d lines pasted", E.cliplen);
+            break;
+    }
+}
+
+// We ask for a file name and open it on a new buffer
+void promptOpenFile(){
+    char *filename = prompt("Open file: %s");
+    if (filename == NULL) return;
+
+    // We dont die if the file cant be opened, we just tell the user
+    if (access(filename, R_OK) == -1){
+        setStatusMessage("Can't open %s: %s", filename, strerror(errno));
+    }else{
+        openBuffer(filename);
+    }
+    free(filename);
+}
+
+// We ask for a new tab stop and render the rows with tabs again
+void promptTabStop(){
+    char *answer = prompt("Tab stop: %s");
+    if (answer == NULL) return;
+
+    int tabstop = atoi(answer);
+    if (tabstop < 1 || tabstop > MAX_TAB_STOP){
+        setStatusMessage("Invalid tab stop: %s", answer);
+    }else{
+        E.tabstop = tabstop;
+        retabRows();
+        clipboardRetab();
+        setStatusMessage("Tab stop set to %d", tabstop);
+    }
+    free(answer);
+}
+
+// We ask for an offset and move the cursor of the hex view there
+void hexJumpToOffset(){
+    char *answer = prompt("Go to offset (0x for hex): %s");
+    if (answer == NULL) return;
+
+    char *end;
+    unsigned long long off = strtoull(answer, &end, 0);
+    if (*end != '\0'){
+        setStatusMessage("Invalid offset: %s", answer);
+    }else{
+        // We stop on the last byte if the offset is too big
+        E.file.hex.cursor = off < E.file.hex.size ? off : E.file.hex.size - 1;
+        E.file.hex.nibble = 0;
+        // We show the line of the offset at the top of the screen
+        E.file.hex.offset = E.file.hex.cursor - E.file.hex.cursor % HEX_BYTES_PER_LINE;
+    }
+    free(answer);
+}
+
+// Keys on the hex view
+void hexProcessKey(int c){
+    size_t page = (size_t)E.screenrows * HEX_BYTES_PER_LINE;
+    size_t old = E.file.hex.cursor;
+
+    switch (c){
+        case ARROW_LEFT:
+            if (E.file.hex.cursor > 0) E.file.hex.cursor--;
+            break;
+        case ARROW_RIGHT:
+            if (E.file.hex.cursor + 1 < E.file.hex.size) E.file.hex.cursor++;
+            break;
+        case ARROW_UP:
+            if (E.file.hex.cursor >= HEX_BYTES_PER_LINE) E.file.hex.cursor -= HEX_BYTES_PER_LINE;
+            break;
+        case ARROW_DOWN:
+            if (E.file.hex.cursor + HEX_BYTES_PER_LINE < E.file.hex.size) E.file.hex.cursor += HEX_BYTES_PER_LINE;
+            break;
+        case PAGE_UP:
+            E.file.hex.cursor = E.file.hex.cursor > page ? E.file.hex.cursor - page : 0;
+            break;
+        case PAGE_DOWN:
+            E.file.hex.cursor = E.file.hex.cursor + page < E.file.hex.size ? E.file.hex.cursor + page : E.file.hex.size - 1;
+            break;
+        case HOME_KEY:
+            E.file.hex.cursor -= E.file.hex.cursor % HEX_BYTES_PER_LINE;
+            break;
+        case END_KEY:
+            E.file.hex.cursor += HEX_BYTES_PER_LINE - 1 - E.file.hex.cursor % HEX_BYTES_PER_LINE;
+            if (E.file.hex.cursor >= E.file.hex.size) E.file.hex.cursor = E.file.hex.size - 1;
+            break;
+        case CTRL_KEY('g'):
+            hexJumpToOffset();
+            break;
+        case CTRL_KEY('s'):
+            hexSave();
+            break;
+        default:
+            // Hex digits overwrite the byte under the cursor
+            if (c < 128 && isxdigit(c)){
+                hexOverwrite(isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+            }
+            break;
+    }
+    // If we moved to another byte we start writing it from the high half
+    if (E.file.hex.cursor != old) E.file.hex.nibble = 0;
+}
+
+// We move the cursor to the start of the visual line 'vline'
+void moveCursorToVisualLine(int vline){
+    int total = wrapTreePrefix(E.file.numrows);
+    int subline;
+    if (vline < 0) vline = 0;
+    if (vline > total) vline = total;
+
+    E.file.cy = wrapTreeFind(vline, &subline);
+    E.file.cx = E.file.cy < E.file.numrows ? rowRxToCx(&E.file.row[E.file.cy], subline * E.screencols) : 0;
+}
+
+// We turn soft wrap on and off keeping the same row at the top of the screen
+void toggleSoftWrap(){
+    E.softwrap = !E.softwrap;
+    if (E.softwrap){
+        wrapEnsureLayout();
+        E.file.vrowoffset = wrapTreePrefix(E.file.rowoffset);
+    }
+    setStatusMessage("Soft wrap %s", E.softwrap ? "on" : "off");
+}
+
 void moveCursor(int key){
     // We check if the row position is farther down than the last line of the file, if it is we set the pointer to that line to NULL ¿?. If it isnt, we set the pointer to the corresponding pointer of the line at that index 
     // this is for the cx movement, to check if the line has something, if it doesnt you cant move right
     // Also, apparently i forgot to change the arrow down conditional at some point I fucked up in step 69
-    erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+    erow *row = (E.file.cy >= E.file.numrows) ? NULL : &E.file.row[E.file.cy];
 
     switch (key){
         // Move left
         case ARROW_LEFT:
-            if (E.cx != 0){ // cant go left if cursor is on the left
-                E.cx--;
+            if (E.file.cx != 0){ // cant go left if cursor is on the left
+                E.file.cx--;
 	    // If the cursor is on the first column and not on the first line and left is pressed
-            } else if(E.cy > 0){
+            } else if(E.file.cy > 0){
 		// we go one row up
-		E.cy--;
+		E.file.cy--;
 		// we go to the end of the line
-		E.cx = E.row[E.cy].size;
+		E.file.cx = E.file.row[E.file.cy].size;
 	    }
             break;
         // Move right
         case ARROW_RIGHT:
             // If row isnt null and cx is less than the length of the row we can move.
             // (this is what i proposed on the last step but i proposed row.size, idk the difference between . and ->)(-> is used when accessing a propriety from a pointer, the "." is used when referincing the variable directly)
-            if (row && E.cx < row->size){
-                E.cx++;
+            if (row && E.file.cx < row->size){
+                E.file.cx++;
             // If the row exists (we arent on the last row) and we are at the end of the line (TODO what is the difference between row.size and row->size)
-            }else if (row && E.cx == row->size){
+            }else if (row && E.file.cx == row->size){
                 // We move to the start of the next line
-                E.cy++;
-                E.cx = 0;
+                E.file.cy++;
+                E.file.cx = 0;
             }
             break;
         // Move up
         case ARROW_UP:
-            if (E.cy != 0){ // cant go up if cursor is at the top
-                E.cy--;
+            if (E.file.cy != 0){ // cant go up if cursor is at the top
+                E.file.cy--;
             }
             break;
         // Move down
         case ARROW_DOWN:
-            if (E.cy < E.numrows){ // Can go one row lower than the last line on the file
-                E.cy++;
+            if (E.file.cy < E.file.numrows){ // Can go one row lower than the last line on the file
+                E.file.cy++;
             }
             break;
     }
 
     // We set row again since cy may have changed
-    row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+    row = (E.file.cy >= E.file.numrows) ? NULL : &E.file.row[E.file.cy];
     // We get the legth of the row we are in (if it exists)
     int rowlen = row ? row->size : 0;
     // If we are too far right we snap back to the end of the line
-    if (E.cx > rowlen){
-	    E.cx = rowlen;
+    if (E.file.cx > rowlen){
+	    E.file.cx = rowlen;
     }
 }
 
 void processKeypress(){
     int c = readKey();
 
+    // Keys for switching and opening buffers work on every buffer
+    switch (c){
+        case CTRL_KEY('o'):
+            promptOpenFile();
+            return;
+        case CTRL_KEY('n'):
+            switchBuffer((E.curbuffer + 1) % E.numbuffers);
+            return;
+        case CTRL_KEY('p'):
+            switchBuffer((E.curbuffer + E.numbuffers - 1) % E.numbuffers);
+            return;
+    }
+
+    // The hex view has its own keys, only quitting and resizing are shared
+    if (E.file.hex.map && c != CTRL_KEY('q') && c != RESIZE_EVENT){
+        hexProcessKey(c);
+        return;
+    }
+
     // We decide what to do with special keypresses depending on the type of keypress
     switch (c){
         case CTRL_KEY('q'):
@@ -583,27 +2485,36 @@ void processKeypress(){
 
         // Home key moves the cursor to the column 0
         case HOME_KEY:
-            E.cx = 0;
+            E.file.cx = 0;
             break;
         // End key moves the cursor to the last column
         case END_KEY:
             // If the cursor id not on the last (non existing) line
-            if (E.cy < E.numrows){
+            if (E.file.cy < E.file.numrows){
                 // We move the cursor to the last element of the line we are on
-                E.cx = E.row[E.cy].size;
+                E.file.cx = E.file.row[E.file.cy].size;
             }
             break;
 
         // For the page up and page down keys
         case PAGE_UP:
         case PAGE_DOWN:
+            // With soft wrap a page is a screen of visual lines, we find the row on the target line in the tree
+            if (E.softwrap){
+                if (c == PAGE_UP){
+                    moveCursorToVisualLine(E.file.vrowoffset - E.screenrows);
+                }else{
+                    moveCursorToVisualLine(E.file.vrowoffset + 2*E.screenrows - 1);
+                }
+                break;
+            }
             {
                 // We move the cursor to the edge of the screen before we move the cursor for one full page
                 if (c == PAGE_UP){
-                    E.cy = E.rowoffset;
+                    E.file.cy = E.file.rowoffset;
                 }else if (c == PAGE_DOWN){
-                    E.cy = E.rowoffset + E.screenrows - 1;
-                    if (E.cy > E.numrows) E.cy = E.numrows;
+                    E.file.cy = E.file.rowoffset + E.screenrows - 1;
+                    if (E.file.cy > E.file.numrows) E.file.cy = E.file.numrows;
                 }
 
                 // We run a loop for as many rows as the terminal has
@@ -622,6 +2533,32 @@ void processKeypress(){
         case ARROW_DOWN:
             moveCursor(c);
             break;
+
+        case CTRL_KEY('w'):
+            toggleSoftWrap();
+            break;
+
+        case CTRL_KEY('t'):
+            promptTabStop();
+            break;
+
+        case CTRL_KEY('b'):
+        case CTRL_KEY('c'):
+        case CTRL_KEY('x'):
+        case CTRL_KEY('v'):
+            processClipboardKey(c);
+            break;
+
+        // The terminal changed size, we read the new size and the screen is redrawn after this
+        // The wrap layout is rebuilt the next time it is used since screencols changed
+        case RESIZE_EVENT:
+            updateWindowSize();
+            break;
+
+        case FILE_CHANGED_EVENT:
+            watchReload();
+            break;
+
         default:
             insertChar(c);
             break;
@@ -631,16 +2568,61 @@ void processKeypress(){
 
 /*** Output ***/
 
+// We draw the bytes on screen as lines of offset, hex values and printable characters
+// Only the visible part of the mapping is read, so the kernel only loads those pages
+void hexDrawRows(struct abuf *ab){
+    static const char digits[] = "0123456789abcdef";
+    int y;
+    for (y = 0; y < E.screenrows; y++){
+        size_t off = E.file.hex.offset + (size_t)y * HEX_BYTES_PER_LINE;
+        if (off >= E.file.hex.size){
+            abAppend(ab, "~", 1);
+        }else{
+            // The offset, 2 spaces, 3 columns for every byte in hex and 1 for every byte as a character
+            char line[HEX_MAX_OFFSET_DIGITS + 2 + HEX_BYTES_PER_LINE * 4 + 1];
+            int len = snprintf(line, sizeof(line), "%0*zx  ", E.file.hex.offsetdigits, off);
+            int i;
+            // We write 2 hex digits for every byte
+            for (i = 0; i < HEX_BYTES_PER_LINE; i++){
+                if (off + i < E.file.hex.size){
+                    line[len++] = digits[E.file.hex.map[off + i] >> 4];
+                    line[len++] = digits[E.file.hex.map[off + i] & 0x0f];
+                }else{
+                    line[len++] = ' ';
+                    line[len++] = ' ';
+                }
+                line[len++] = ' ';
+            }
+            // We write the bytes as characters, the ones that cant be printed are shown as dots
+            for (i = 0; i < HEX_BYTES_PER_LINE && off + i < E.file.hex.size; i++){
+                line[len++] = isprint(E.file.hex.map[off + i]) ? E.file.hex.map[off + i] : '.';
+            }
+            if (len > E.screencols) len = E.screencols;
+            abAppend(ab, line, len);
+        }
+        abAppend(ab, "\x1b[K", 3);
+        abAppend(ab, "\r\n", 2);
+    }
+}
+
 void drawRows(struct abuf *ab){
     int y;
+    // Binary files are drawn by the hex view
+    if (E.file.hex.map){
+        hexDrawRows(ab);
+        return;
+    }
+    // With soft wrap we look for the row on the top visual line and the line inside that row
+    int subline = 0;
+    int filerow = E.softwrap ? wrapTreeFind(E.file.vrowoffset, &subline) : E.file.rowoffset;
     // For all rows we write a tilde at the start of the line
     // We write them to a buffer that will then write every line in one go
     for (y=0;y<E.screenrows;y++){
 	// We create a variable to find the line of the file to draw
-	int filerow = y + E.rowoffset;
+	if (!E.softwrap) filerow = y + E.file.rowoffset;
         // Only draw tildes and version info on the rows that are lower than the rows drawn from the file. ie. only on lines without content
-        if (filerow >= E.numrows){ // I dont quite get the point of this line after step 60. Is it only here to draw tildes on the empty lines under the file? i think so. After step 67 this now makes sense
-            if (E.numrows == 0 && y==E.screenrows/3){
+        if (filerow >= E.file.numrows){ // I dont quite get the point of this line after step 60. Is it only here to draw tildes on the empty lines under the file? i think so. After step 67 this now makes sense
+            if (E.file.numrows == 0 && y==E.screenrows/3){
                 // We define a char array to store the welcome message
                 char welcome_message[80];
 
@@ -666,15 +2648,27 @@ void drawRows(struct abuf *ab){
                 abAppend(ab, "~", 1);
             }
         }else{
+            // The render could have been dropped while the buffer was inactive, we make it again now that it is shown
+            // We do it first since rsize is only right once the render is made
+            if (E.file.row[filerow].render == NULL) updateRow(&E.file.row[filerow]);
+
+            // With soft wrap we start at the piece of the row for this line instead of the sideways offset
+            int start = E.softwrap ? subline * E.screencols : E.file.coloffset;
             // We get the size of the string we need to write. It is the size of the row minus the sideways offset we get from scrolling to the side
-            int len = E.row[filerow].rsize - E.coloffset;
+            int len = E.file.row[filerow].rsize - start;
             // If we scrolled too far right on one line we show 0 bytes from the ones we have scrolled past. We cap the value at 0
             if (len < 0) len = 0;
             // We truncate the length of the string we will draw to the size of the screen
             if (len > E.screencols) len = E.screencols;
 
             // We add the characters to the append buffer. We only add the ones after the number indicated by the column offset
-            abAppend(ab, &E.row[filerow].render[E.coloffset], len);
+            abAppend(ab, &E.file.row[filerow].render[start], len);
+
+            // When we drew the last line of a wrapped row we continue with the next row
+            if (E.softwrap && ++subline >= E.file.row[filerow].wraplines){
+                subline = 0;
+                filerow++;
+            }
         }
 
         abAppend(ab, "\x1b[K", 3);
@@ -693,13 +2687,33 @@ void drawStatusBar(struct abuf *ab){
     abAppend(ab, "\x1b[7m", 4);
 
     // We create a string to hold the status of the file and another to keep the status that will be written on the right side of the screen
-    char status[80], rstatus[80];
+    // The statistics of a big file take about 120 characters, rstatus has space for all of them
+    char status[80], rstatus[160];
     // We set the status to the filename and number of lines on the file if there is one
     // If there is no file, we set the status to "[No Name]"
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines", E.filename ? E.filename : "[No Name]", E.numrows);
+    int len, rlen;
+    if (E.file.hex.map){
+        // On the hex view we show the size of the file, the pages changed and the offset of the cursor
+        len = snprintf(status, sizeof(status), "%.20s - %zu bytes%s%s", E.file.filename, E.file.hex.size,
+            E.file.hex.numdirty ? " (modified)" : "", E.file.hex.readonly ? " [read only]" : "");
+        rlen = snprintf(rstatus, sizeof(rstatus), "0x%zx", E.file.hex.cursor);
+    }else{
+        len = snprintf(status, sizeof(status), "%.20s - %d lines%s", E.file.filename ? E.file.filename : "[No Name]", E.file.numrows,
+            E.file.dirty ? " (modified)" : "");
 
-    // We write to rstatus the numberline we are on
-    int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d", E.cy+1, E.numrows);
+        // We write to rstatus the statistics of the file and the numberline we are on
+        // They are kept up to date on every edit so this doesnt look at the rows
+        rlen = snprintf(rstatus, sizeof(rstatus), "%lld words %lld chars %zu bytes crc32 %08x %d/%d",
+            E.file.words, E.file.nchars, E.file.filebytes, (unsigned)statsChecksum(), E.file.cy+1, E.file.numrows);
+    }
+    if (rlen >= (int)sizeof(rstatus)) rlen = sizeof(rstatus) - 1;
+    // If there is more than one buffer we show which one we are on
+    if (E.numbuffers > 1 && len < (int)sizeof(status)){
+        len += snprintf(&status[len], sizeof(status) - len, " [%d/%d]", E.curbuffer + 1, E.numbuffers);
+        if (len >= (int)sizeof(status)) len = sizeof(status) - 1;
+    }
+    // If there is no space for the statistics we only show the numberline
+    if (!E.file.hex.map && len + rlen > E.screencols) rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d", E.file.cy+1, E.file.numrows);
 
     // if the length of the status message is too big for the screen we cut it off
     if (len > E.screencols) len = E.screencols;
@@ -768,10 +2782,20 @@ void refreshScreen(){
     // We create a character array
     char buf[32];
     // We assign the escape sequence to position cursor to our buffer array with the coordinates we want the cursor to be in
-    // The position of the cursor on E.cy is the position of the cursor on the file (0 indexed)
+    // The position of the cursor on E.file.cy is the position of the cursor on the file (0 indexed)
     // We subtract from the position of the cursor on the file, the offset of the lines to get the position the cursor should be on on the screen
     // We do the same for the offset of the columns, we subtract it from the position of the cursor to get the position on the terminal screen
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoffset) + 1, (E.rx-E.coloffset)+1);
+    // With soft wrap the cursor is on its visual line and the column wraps with the screen width
+    if (E.file.hex.map){
+        // On the hex view the cursor is on the hex digit being edited
+        snprintf(buf, sizeof(buf), "\x1b[%d;%dH",
+            (int)((E.file.hex.cursor - E.file.hex.offset) / HEX_BYTES_PER_LINE) + 1,
+            E.file.hex.offsetdigits + 2 + (int)(E.file.hex.cursor % HEX_BYTES_PER_LINE) * 3 + E.file.hex.nibble + 1);
+    }else if (E.softwrap){
+        snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (cursorVisualLine() - E.file.vrowoffset) + 1, (E.file.rx % E.screencols)+1);
+    }else{
+        snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.file.cy - E.file.rowoffset) + 1, (E.file.rx-E.file.coloffset)+1);
+    }
     // We add the characters to the write buffer
     abAppend(&ab, buf, strlen(buf));
 
@@ -802,37 +2826,516 @@ void setStatusMessage(const char *fmt, ...){
 }
 
 
+/*** batch mode ***/
+
+// In batch mode we apply a script of commands to a file in one pass without loading it
+// Only one window of input and two windows of output are in memory, so it works with files of any size
+
+// A pattern of a batch command. Patterns without special characters are searched as plain strings, which is a lot faster
+typedef struct batchpattern {
+    regex_t re;
+    // If it is not NULL the pattern is this string and re is not used
+    char *literal;
+    size_t literallen;
+} batchpattern;
+
+// A command of the script: an address that selects lines and what to do with them
+typedef struct batchcmd {
+    // Lines from first to last (counting from 1) are selected
+    long long first, last;
+    // If hasaddr is set, lines matching addr are selected instead
+    int hasaddr;
+    batchpattern addr;
+
+    // 'd' deletes the line, 's' replaces the matches of pat with repl
+    char op;
+    batchpattern pat;
+    char *repl;
+    // If every match is replaced or only the first one
+    int global;
+} batchcmd;
+
+// The output is written by a thread while we fill the other buffer
+typedef struct batchwriter {
+    int fd;
+    char *buf[2];
+    size_t len[2];
+    // Buffer we are filling
+    int cur;
+    // Buffer the thread has to write, or -1 if it is idle
+    int pending;
+    int done;
+    int error;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} batchwriter;
+
+// We exit with an error without touching the terminal, batch mode never enables raw mode
+void batchDie(const char *s){
+    perror(s);
+    exit(1);
+}
+
+// We compile a pattern. It returns 0 if the regular expression is not valid
+int batchCompile(batchpattern *p, char *src){
+    // If the pattern has no special characters we use it as a plain string
+    if (strpbrk(src, ".[]()*+?{}|^$\\") == NULL){
+        p->literal = src;
+        p->literallen = strlen(src);
+        return 1;
+    }
+    p->literal = NULL;
+    return regcomp(&p->re, src, REG_EXTENDED) == 0;
+}
+
+// We look for the pattern in s[from..len). On a match m[0] holds its position and m[1..9] the groups
+int batchMatch(batchpattern *p, const char *s, size_t len, size_t from, regmatch_t *m){
+    if (p->literal){
+        const char *found = memmem(s + from, len - from, p->literal, p->literallen);
+        if (found == NULL) return 0;
+        m[0].rm_so = found - s;
+        m[0].rm_eo = m[0].rm_so + p->literallen;
+        m[1].rm_so = -1;
+        return 1;
+    }
+    // REG_STARTEND lets us search the line inside the read window without adding a zero byte
+    m[0].rm_so = from;
+    m[0].rm_eo = len;
+    return regexec(&p->re, s, BATCH_MAX_GROUPS, m, REG_STARTEND | (from > 0 ? REG_NOTBOL : 0)) == 0;
+}
+
+// We read a field that ends in 'delim' and move *p after it. '\' followed by the delimiter is the delimiter itself
+char *batchParseField(char **p, char delim){
+    char *field = malloc(strlen(*p) + 1);
+    size_t len = 0;
+    char *s = *p;
+    while (*s && *s != delim){
+        if (*s == '\\' && s[1] == delim) s++;
+        field[len++] = *s++;
+    }
+    if (*s != delim){
+        free(field);
+        return NULL;
+    }
+    field[len] = '\0';
+    *p = s + 1;
+    return field;
+}
+
+// We parse one line of the script. It returns 0 if the line is not valid
+// The commands look like sed: "[address]d" or "[address]s/pattern/replacement/[g]"
+// The address can be empty (every line), "N", "N,M", "N,$" or "/pattern/"
+int batchParseCommand(char *s, batchcmd *cmd){
+    cmd->first = 1;
+    cmd->last = LLONG_MAX;
+    cmd->hasaddr = 0;
+    cmd->global = 0;
+
+    if (isdigit((unsigned char)*s)){
+        cmd->first = cmd->last = strtoll(s, &s, 10);
+        if (*s == ','){
+            s++;
+            if (*s == '$'){
+                cmd->last = LLONG_MAX;
+                s++;
+            }else if (isdigit((unsigned char)*s)){
+                cmd->last = strtoll(s, &s, 10);
+            }else{
+                return 0;
+            }
+        }
+    }else if (*s == '/'){
+        s++;
+        char *addr = batchParseField(&s, '/');
+        if (addr == NULL || !batchCompile(&cmd->addr, addr)) return 0;
+        cmd->hasaddr = 1;
+    }
+
+    cmd->op = *s++;
+    if (cmd->op == 'd'){
+        return *s == '\0';
+    }
+    if (cmd->op != 's' || *s == '\0') return 0;
+
+    // Like sed, the character after 's' is the delimiter
+    char delim = *s++;
+    char *pat = batchParseField(&s, delim);
+    if (pat == NULL || !batchCompile(&cmd->pat, pat)) return 0;
+    cmd->repl = batchParseField(&s, delim);
+    if (cmd->repl == NULL) return 0;
+    if (*s == 'g'){
+        cmd->global = 1;
+        s++;
+    }
+    return *s == '\0';
+}
+
+// We read all the commands of the script
+batchcmd *batchLoadScript(char *filename, int *numcmds){
+    FILE *fp = fopen(filename, "r");
+    if (!fp) batchDie(filename);
+
+    batchcmd *cmds = NULL;
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    int lineno = 0;
+    *numcmds = 0;
+    while ((linelen = getline(&line, &linecap, fp)) != -1){
+        lineno++;
+        while (linelen > 0 && (line[linelen-1] == '\n' || line[linelen-1] == '\r')) line[--linelen] = '\0';
+        // We skip empty lines and comments
+        if (linelen == 0 || line[0] == '#') continue;
+
+        cmds = realloc(cmds, sizeof(batchcmd) * (*numcmds + 1));
+        if (!batchParseCommand(line, &cmds[*numcmds])){
+            fprintf(stderr, "%s:%d: invalid command: %s\n", filename, lineno, line);
+            exit(1);
+        }
+        (*numcmds)++;
+    }
+    free(line);
+    fclose(fp);
+    return cmds;
+}
+
+// Thread that writes the full buffers while the main thread fills the other one
+void *batchWriterThread(void *arg){
+    batchwriter *w = arg;
+    pthread_mutex_lock(&w->lock);
+    while (1){
+        while (w->pending == -1 && !w->done) pthread_cond_wait(&w->cond, &w->lock);
+        if (w->pending == -1) break;
+
+        // We dont hold the lock while writing so the main thread can keep filling its buffer
+        int b = w->pending;
+        pthread_mutex_unlock(&w->lock);
+        size_t off = 0;
+        int error = 0;
+        while (off < w->len[b]){
+            ssize_t n = write(w->fd, w->buf[b] + off, w->len[b] - off);
+            if (n == -1){
+                if (errno == EINTR) continue;
+                error = errno;
+                break;
+            }
+            off += n;
+        }
+        pthread_mutex_lock(&w->lock);
+        if (error) w->error = error;
+        w->pending = -1;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+// We give the buffer we were filling to the writer thread and continue on the other one
+void batchWriterSwap(batchwriter *w){
+    pthread_mutex_lock(&w->lock);
+    // We wait until the thread finished with the other buffer
+    while (w->pending != -1) pthread_cond_wait(&w->cond, &w->lock);
+    if (w->error){
+        errno = w->error;
+        batchDie("write");
+    }
+    w->pending = w->cur;
+    w->cur = !w->cur;
+    w->len[w->cur] = 0;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+void batchWriterAppend(batchwriter *w, const char *s, size_t len){
+    while (len > 0){
+        size_t space = BATCH_WINDOW - w->len[w->cur];
+        size_t n = len < space ? len : space;
+        memcpy(w->buf[w->cur] + w->len[w->cur], s, n);
+        w->len[w->cur] += n;
+        s += n;
+        len -= n;
+        if (w->len[w->cur] == BATCH_WINDOW) batchWriterSwap(w);
+    }
+}
+
+void batchWriterStart(batchwriter *w, int fd){
+    w->fd = fd;
+    w->buf[0] = malloc(BATCH_WINDOW);
+    w->buf[1] = malloc(BATCH_WINDOW);
+    w->len[0] = w->len[1] = 0;
+    w->cur = 0;
+    w->pending = -1;
+    w->done = 0;
+    w->error = 0;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    if (pthread_create(&w->thread, NULL, batchWriterThread, w) != 0) batchDie("pthread_create");
+}
+
+// We write what is left and wait for the thread to finish
+void batchWriterFinish(batchwriter *w){
+    batchWriterSwap(w);
+    pthread_mutex_lock(&w->lock);
+    while (w->pending != -1) pthread_cond_wait(&w->cond, &w->lock);
+    w->done = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+    if (w->error){
+        errno = w->error;
+        batchDie("write");
+    }
+    free(w->buf[0]);
+    free(w->buf[1]);
+}
+
+// Space for the lines that were changed by a substitution
+typedef struct batchline {
+    char *b;
+    size_t len;
+    size_t cap;
+} batchline;
+
+void batchLineAppend(batchline *l, const char *s, size_t len){
+    if (l->len + len > l->cap){
+        while (l->len + len > l->cap) l->cap = l->cap ? l->cap * 2 : 256;
+        l->b = realloc(l->b, l->cap);
+    }
+    memcpy(l->b + l->len, s, len);
+    l->len += len;
+}
+
+// We replace the matches of cmd->pat in line and leave the result in 'out'. It returns the number of replacements
+long long batchSubstitute(batchcmd *cmd, const char *line, size_t len, batchline *out){
+    regmatch_t m[BATCH_MAX_GROUPS];
+    size_t from = 0;
+    long long count = 0;
+    // End of the last match that wasnt empty. Like sed, an empty match right after it is not replaced
+    size_t lastend = (size_t)-1;
+    out->len = 0;
+
+    while (from <= len && batchMatch(&cmd->pat, line, len, from, m)){
+        if (m[0].rm_eo == m[0].rm_so && (size_t)m[0].rm_so == lastend){
+            // We copy the character after it and look again from the next one
+            if (from < len) batchLineAppend(out, line + from, 1);
+            from++;
+            continue;
+        }
+
+        // We copy what is before the match
+        batchLineAppend(out, line + from, m[0].rm_so - from);
+
+        // We copy the replacement. & is the whole match and \1 to \9 are the groups
+        char *r;
+        for (r = cmd->repl; *r; r++){
+            if (*r == '&'){
+                batchLineAppend(out, line + m[0].rm_so, m[0].rm_eo - m[0].rm_so);
+            }else if (*r == '\\' && r[1] >= '1' && r[1] <= '9'){
+                int g = *++r - '0';
+                if (!cmd->pat.literal && m[g].rm_so != -1) batchLineAppend(out, line + m[g].rm_so, m[g].rm_eo - m[g].rm_so);
+            }else{
+                if (*r == '\\' && r[1]) r++;
+                batchLineAppend(out, r, 1);
+            }
+        }
+        count++;
+
+        from = m[0].rm_eo;
+        if (m[0].rm_eo > m[0].rm_so) lastend = from;
+        // An empty match would match again on the same place, we copy one character and move on
+        if (m[0].rm_eo == m[0].rm_so){
+            if (from < len) batchLineAppend(out, line + from, 1);
+            from++;
+        }
+        if (!cmd->global) break;
+    }
+    // We copy what is after the last match
+    if (from < len) batchLineAppend(out, line + from, len - from);
+    return count;
+}
+
+// Totals we print when the script finishes
+typedef struct batchstats {
+    long long lines;
+    long long deleted;
+    long long replaced;
+} batchstats;
+
+// We apply all the commands to one line (without its newline) and write it if it wasnt deleted
+void batchProcessLine(batchcmd *cmds, int numcmds, const char *line, size_t len, int newline,
+        batchline scratch[2], batchwriter *w, batchstats *stats){
+    regmatch_t m[BATCH_MAX_GROUPS];
+    int i;
+    // Every substitution writes in the scratch buffer the line is not using
+    int next = 0;
+    stats->lines++;
+
+    for (i = 0; i < numcmds; i++){
+        batchcmd *cmd = &cmds[i];
+        // We check if the line is selected by the address of the command
+        if (cmd->hasaddr){
+            if (!batchMatch(&cmd->addr, line, len, 0, m)) continue;
+        }else if (stats->lines < cmd->first || stats->lines > cmd->last){
+            continue;
+        }
+
+        if (cmd->op == 'd'){
+            stats->deleted++;
+            return;
+        }
+        long long n = batchSubstitute(cmd, line, len, &scratch[next]);
+        if (n){
+            stats->replaced += n;
+            line = scratch[next].b;
+            len = scratch[next].len;
+            next = !next;
+        }
+    }
+    batchWriterAppend(w, line, len);
+    if (newline) batchWriterAppend(w, "\n", 1);
+}
+
+// We run the script on the file and write the result to output
+// If there is no output file we write to a temporary file and replace the input with it when we finish
+int batchMain(int argc, char *argv[]){
+    if (argc < 4 || argc > 5){
+        fprintf(stderr, "Usage: tonne --batch script file [output]\n");
+        return 1;
+    }
+    int numcmds;
+    batchcmd *cmds = batchLoadScript(argv[2], &numcmds);
+    char *input = argv[3];
+
+    int in = open(input, O_RDONLY);
+    if (in == -1) batchDie(input);
+    struct stat st;
+    if (fstat(in, &st) == -1) batchDie("fstat");
+    // We tell the kernel we read the file once from start to end so it reads ahead and drops the pages we already used
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    char tmpname[PATH_MAX];
+    char *output = argc == 5 ? argv[4] : NULL;
+    // If the output is the input file, opening it would empty the file before we read it. We replace the input instead
+    struct stat outst;
+    if (output && stat(output, &outst) == 0 && outst.st_dev == st.st_dev && outst.st_ino == st.st_ino) output = NULL;
+    if (output == NULL){
+        snprintf(tmpname, sizeof(tmpname), "%s.tonne-batch", input);
+        output = tmpname;
+    }
+    int out = open(output, O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 0777);
+    if (out == -1) batchDie(output);
+
+    batchwriter w;
+    batchWriterStart(&w, out);
+    batchline scratch[2] = {{NULL, 0, 0}, {NULL, 0, 0}};
+    batchstats stats = {0, 0, 0};
+
+    // The window holds the lines we read. A line that doesnt fit is moved to the start and we read after it
+    size_t cap = BATCH_WINDOW;
+    char *window = malloc(cap);
+    size_t filled = 0;
+    ssize_t n;
+    while (1){
+        // If a single line fills the whole window we make it bigger
+        if (filled == cap){
+            cap *= 2;
+            window = realloc(window, cap);
+        }
+        n = read(in, window + filled, cap - filled);
+        if (n == -1){
+            if (errno == EINTR) continue;
+            batchDie("read");
+        }
+        if (n == 0) break;
+        filled += n;
+
+        // We process every complete line in the window
+        char *start = window;
+        char *end = window + filled;
+        char *nl;
+        while ((nl = memchr(start, '\n', end - start)) != NULL){
+            batchProcessLine(cmds, numcmds, start, nl - start, 1, scratch, &w, &stats);
+            start = nl + 1;
+        }
+        // We keep the incomplete line for the next read
+        filled = end - start;
+        memmove(window, start, filled);
+    }
+    // The last line may not end in a newline
+    if (filled > 0) batchProcessLine(cmds, numcmds, window, filled, 0, scratch, &w, &stats);
+
+    batchWriterFinish(&w);
+    if (fsync(out) == -1 && errno != EINVAL) batchDie("fsync");
+    close(out);
+    close(in);
+
+    if (output == tmpname && rename(tmpname, input) == -1) batchDie("rename");
+
+    fprintf(stderr, "%lld lines, %lld deleted, %lld replacements\n", stats.lines, stats.deleted, stats.replaced);
+    return 0;
+}
+
+
 /*** Init ***/
 
 void initEditor(){
-    E.cx = 0;
-    E.cy = 0;
-    E.rx = 0;
-    E.rowoffset = 0;
-    E.coloffset = 0;
-    E.numrows = 0;
-    E.row = NULL;
-    E.filename = NULL;
+    // The tab stop can be set with an environment variable
+    char *tabstop = getenv("TONNE_TAB_STOP");
+    E.tabstop = tabstop ? atoi(tabstop) : TONNE_TAB_STOP;
+    if (E.tabstop < 1 || E.tabstop > MAX_TAB_STOP) E.tabstop = TONNE_TAB_STOP;
+
+    resetBufferState();
     E.statusmsg[0] = '\0';
     E.statusmsg_time = 0;
-
-    if (getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
-    // We remove 2 rows from the total available in the terminal so we have space for the status bar
-    E.screenrows --;
-    E.screenrows --;
+    E.softwrap = 0;
+    E.clip = NULL;
+    E.cliplen = 0;
+    E.clipcap = 0;
+    poolInit();
+
+    // We start with one empty buffer, opening a file replaces it
+    E.buffers = malloc(sizeof(ebuffer));
+    E.buffers[0].evicted = 0;
+    E.numbuffers = 1;
+    E.curbuffer = 0;
+    E.bufferclock = 0;
+
+    // The memory budget is in MB
+    char *budget = getenv("TONNE_MEMORY_BUDGET");
+    E.membudget = (size_t)(budget ? atol(budget) : TONNE_MEMORY_BUDGET) * 1024 * 1024;
+
+    updateWindowSize();
+    // We get notified when the terminal changes size
+    signal(SIGWINCH, handleSigWinch);
 }
 
 // Main has 2 parameters to handle arguments
 int main(int argc, char *argv[]){
+    // Batch mode doesnt use the terminal at all
+    if (argc >= 2 && strcmp(argv[1], "--batch") == 0) return batchMain(argc, argv);
+
     enableTermRawMode();
     initEditor();
     // if there is an argument, we open the file
     // TODO is it as simple as that to handle arguments? they are passed by the shell directly to main?
-    if (argc >= 2){
-        openFile(argv[1]);
+    // Every file passed opens on its own buffer, the first one replaces the empty buffer we start with
+    int i;
+    for (i = 1; i < argc; i++){
+        if (i == 1){
+            openFile(argv[i]);
+        }else{
+            openBuffer(argv[i]);
+        }
     }
+    // We start on the first file
+    switchBuffer(0);
 
-    setStatusMessage("HELP: Ctrl+Q = quit");
+    if (E.file.hex.map){
+        setStatusMessage("HELP: Ctrl+Q = quit | Ctrl+G = go to offset | Ctrl+S = save");
+    }else{
+        setStatusMessage("HELP: Ctrl+Q = quit | Ctrl+O/N/P = open/next/prev file | Ctrl+W = soft wrap | Ctrl+T = tab stop | Ctrl+B/X/C/V = mark/cut/copy/paste lines");
+    }
 
     // while always
     while (1){